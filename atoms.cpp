@@ -1,10 +1,140 @@
 #include "atoms.h"
+#include "jit.h"
+#include "macro.h"
+#include "printer.h"
 
 #include <algorithm>
 #include <stdexcept>
 #include <sstream>
 
-std::list<const Atom*> Atom::pool_;
+Pool Atom::pool_;
+
+// Cells are carved out of large blocks, so the cells of a list built in
+// one go lie next to each other in memory.
+class NodeHeap
+{
+public:
+    NodeHeap() : free_(0), next_(0), end_(0)
+    {
+    }
+
+    ~NodeHeap()
+    {
+        for(std::vector<char*>::iterator i = blocks_.begin(); i != blocks_.end(); ++i)
+        {
+            ::operator delete(*i);
+        }
+    }
+
+    void* allocate(std::size_t size)
+    {
+        if(free_ != 0)
+        {
+            void* p = free_;
+            free_ = *static_cast<void**>(p);
+            return p;
+        }
+        if(next_ == end_)
+        {
+            blocks_.push_back(static_cast<char*>(::operator new(size * BlockSize)));
+            next_ = blocks_.back();
+            end_  = next_ + size * BlockSize;
+        }
+        void* p = next_;
+        next_ += size;
+        return p;
+    }
+
+    void release(void* p)
+    {
+        *static_cast<void**>(p) = free_;
+        free_ = p;
+    }
+
+    // takes over the blocks of another heap; its free cells are dropped
+    void adopt(NodeHeap& other)
+    {
+        blocks_.insert(blocks_.end(), other.blocks_.begin(), other.blocks_.end());
+        other.blocks_.clear();
+    }
+
+private:
+    static const std::size_t BlockSize = 4096;
+
+    std::vector<char*> blocks_;
+    void*              free_;
+    char*              next_;
+    char*              end_;
+};
+
+namespace
+{
+
+__thread std::vector<const Atom*>* threadAtoms = 0;
+__thread NodeHeap*                 threadNodes = 0;
+
+NodeHeap& sharedNodeHeap()
+{
+    static NodeHeap heap;
+    return heap;
+}
+
+NodeHeap& nodeHeap()
+{
+    return (threadNodes != 0) ? *threadNodes : sharedNodeHeap();
+}
+
+} // end of anonymous namespace
+
+void Pool::push_back(const Atom* atom)
+{
+    if(threadAtoms != 0)
+    {
+        threadAtoms->push_back(atom);
+    }
+    else
+    {
+        atoms_.push_back(atom);
+    }
+}
+
+std::size_t Pool::size() const
+{
+    return atoms_.size();
+}
+
+Pool::const_iterator Pool::begin() const
+{
+    return atoms_.begin();
+}
+
+Pool::const_iterator Pool::end() const
+{
+    return atoms_.end();
+}
+
+ThreadHeap::ThreadHeap() : nodes_(new NodeHeap)
+{
+}
+
+ThreadHeap::~ThreadHeap()
+{
+    Atom::pool_.atoms_.insert(Atom::pool_.atoms_.end(), atoms_.begin(), atoms_.end());
+    sharedNodeHeap().adopt(*nodes_);
+    delete nodes_;
+}
+
+void ThreadHeap::attach()
+{
+    threadAtoms = &atoms_;
+    threadNodes = nodes_;
+}
+
+void ThreadHeap::detach()
+{
+    threadAtoms = 0;
+    threadNodes = 0;
+}
 
 class Env::Matcher
 {
@@ -20,6 +150,10 @@ private:
     const std::string& key_;
 };
 
+Env::Env(const Env* parent) : parent_(parent)
+{
+}
+
 void Env::push(const std::string& key, const Atom* value)
 {
     dictionary_.push_front(std::make_pair(key, value));
@@ -32,12 +166,27 @@ void Env::pop()
 
 const Atom* Env::find(const std::string& key) const
 {
-    Dictionary::const_iterator i = std::find_if(dictionary_.begin(), dictionary_.end(), Matcher(key));
-    if(i == dictionary_.end())
+    const Atom* value = lookup(key);
+    if(value == 0)
     {
         throw std::runtime_error(key + " is not defined");
     }
-    return i->second;
+    return value;
+}
+
+const Atom* Env::lookup(const std::string& key) const
+{
+    Dictionary::const_iterator i = std::find_if(dictionary_.begin(), dictionary_.end(), Matcher(key));
+    if(i != dictionary_.end())
+    {
+        return i->second;
+    }
+    return (parent_ != 0) ? parent_->lookup(key) : 0;
+}
+
+const Env::Dictionary& Env::dictionary() const
+{
+    return dictionary_;
 }
 
 void Atom::releaseAll()
@@ -47,6 +196,19 @@ void Atom::releaseAll()
     std::for_each(pool_.begin(), pool_.end(), _::delete_);
 }
 
+std::size_t Atom::allocated()
+{
+    return pool_.size();
+}
+
+void Atom::assert_(bool cond, const char* message)
+{
+    if( ! cond)
+    {
+        throw std::runtime_error(message);
+    }
+}
+
 void Atom::assert_(bool cond, const std::string& message)
 {
     if( ! cond)
@@ -77,7 +239,7 @@ std::ostream& operator << (std::ostream& out, const Atom& atom)
     return out;
 }
 
-Integer::Integer(int i) : i_(i)
+Integer::Integer(long long i) : i_(i)
 {
     pool_.push_back(this);
 }
@@ -92,7 +254,7 @@ const Atom* Integer::eval(Env& env) const
     return this;
 }
 
-int Integer::value() const
+long long Integer::value() const
 {
     return i_;
 }
@@ -104,7 +266,9 @@ Real::Real(double r) : r_(r)
 
 void Real::write(std::ostream& out) const
 {
-    out << r_;
+    std::string s;
+    Printer::real(r_, s);
+    out << s;
 }
 
 const Real* Real::eval(Env& env) const
@@ -124,7 +288,7 @@ Bool::Bool(bool b) : b_(b)
 
 void Bool::write(std::ostream& out) const
 {
-    out << std::boolalpha << b_;
+    out << (b_ ? "true" : "false");
 }
 
 const Bool* Bool::eval(Env& env) const
@@ -176,16 +340,41 @@ const Atom* Function::evalList(const Node* node, Env& env) const
     return node->evalFunction(this, env);
 }
 
+const Atom* Function::call(Frame& frame, const Node*) const
+{
+    return frame.invoke();
+}
+
 const Node* Function::args() const
 {
     return args_;
 }
 
-Lambda::Lambda(const Node* args, const Node* exp) : Function(args), exp_(exp)
+void Macro::write(std::ostream& out) const
+{
+    out << "macro";
+}
+
+const Macro* Macro::eval(Env&) const
+{
+    return this;
+}
+
+const Atom* Macro::evalList(const Node* node, Env& env) const
+{
+    return node->evalMacro(this, env);
+}
+
+Lambda::Lambda(const Node* args, const Node* exp) : Function(args), exp_(exp), calls_(0), native_(0)
 {
     pool_.push_back(this);
 }
 
+Lambda::~Lambda()
+{
+    delete native_;
+}
+
 void Lambda::write(std::ostream& out) const
 {
     out << "lambda " << *args() << " " << *exp_;
@@ -193,9 +382,29 @@ void Lambda::write(std::ostream& out) const
 
 const Atom* Lambda::eval(Env& env) const
 {
+    // counts up to the threshold only, so a lambda that cannot be
+    // compiled is tried once and the count never overflows
+    const int threshold = NativeCode::threshold();
+    if((native_ == 0) && (calls_ < threshold) && (++calls_ == threshold))
+    {
+        native_ = NativeCode::compile(this, env);
+    }
+    if(native_ != 0)
+    {
+        const Atom* result = native_->call(env);
+        if(result != 0)
+        {
+            return result;
+        }
+    }
     return exp_->eval(env);
 }
 
+const Node* Lambda::exp() const
+{
+    return exp_;
+}
+
 
 Node::Iterator::Iterator(const Node* node) : node_(node)
 {
@@ -237,12 +446,29 @@ const Node* Node::getNull()
     return null;
 }
 
-Node::Node() : car_(0), cdr_(0)
+void* Node::operator new(std::size_t size)
+{
+    return (size == sizeof(Node)) ? nodeHeap().allocate(size) : ::operator new(size);
+}
+
+void Node::operator delete(void* p, std::size_t size)
+{
+    if(size == sizeof(Node))
+    {
+        nodeHeap().release(p);
+    }
+    else
+    {
+        ::operator delete(p);
+    }
+}
+
+Node::Node() : car_(0), cdr_(0), length_(0), feedback_(0), expansion_(0)
 {
     pool_.push_back(this);
 }
 
-Node::Node(const Atom* car, const Node* cdr) : car_(car), cdr_(cdr)
+Node::Node(const Atom* car, const Node* cdr) : car_(car), cdr_(cdr), length_((cdr != 0) ? cdr->length_ + 1 : 1), feedback_(0), expansion_(0)
 {
     assert_(car, "atom is null");
     pool_.push_back(this);
@@ -250,12 +476,9 @@ Node::Node(const Atom* car, const Node* cdr) : car_(car), cdr_(cdr)
 
 void Node::write(std::ostream& out) const
 {
-    out << "( ";
-    for(const Node* i = this; i->car_ != 0; i = i->cdr_)
-    {
-        out << *i->car_ << " ";
-    }
-    out << ")";
+    std::string s;
+    Printer(s).print(this);
+    out << s;
 }
 
 const Atom* Node::car() const
@@ -269,6 +492,21 @@ const Node* Node::cdr() const
     return cdr_;
 }
 
+int Node::length() const
+{
+    return length_;
+}
+
+int Node::feedback() const
+{
+    return feedback_;
+}
+
+void Node::feedback(int kind) const
+{
+    feedback_ = static_cast<unsigned char>(kind);
+}
+
 const Atom* Node::eval(Env& env) const
 {
     if(this == getNull())
@@ -283,13 +521,18 @@ const Atom* Node::eval(Env& env) const
 const Atom* Node::evalSymbol(const Symbol* symbol, Env& env) const
 {
     Node::Iterator i(this);
-    if     (symbol->value() == "quote")  return evalQuote(i, env);
-    else if(symbol->value() == "if")     return evalIf(i, env);
-    else if(symbol->value() == "set!")   return evalSet(i, env);
-    else if(symbol->value() == "define") return evalDefine(i, env);
-    else if(symbol->value() == "lambda") return evalLambda(i, env);
-    else if(symbol->value() == "begin")  return evalBegin(i, env);
-    else                                 return symbol->eval(env)->evalList(this, env);
+    if     (symbol->value() == "quote")        return evalQuote(i, env);
+    else if(symbol->value() == "if")           return evalIf(i, env);
+    else if(symbol->value() == "set!")         return evalSet(i, env);
+    else if(symbol->value() == "define")       return evalDefine(i, env);
+    else if(symbol->value() == "lambda")       return evalLambda(i, env);
+    else if(symbol->value() == "begin")        return evalBegin(i, env);
+    else if(symbol->value() == "delay")        return evalDelay(i, env);
+    else if(symbol->value() == "force")        return evalForce(i, env);
+    else if(symbol->value() == "cons-stream")  return evalConsStream(i, env);
+    else if(symbol->value() == "define-macro") return evalDefineMacro(i, env);
+    else if(symbol->value() == "define-syntax")return evalDefineSyntax(i, env);
+    else                                       return symbol->eval(env)->evalList(this, env);
 }
 
 const Atom* Node::evalQuote(Node::Iterator i, Env&) const
@@ -341,27 +584,215 @@ const Atom* Node::evalBegin(Node::Iterator i, Env& env) const
     return result;
 }
 
+const Atom* Node::evalDelay(Node::Iterator i, Env& env) const
+{
+    return new Promise(i->car(), env);
+}
+
+const Atom* Node::evalForce(Node::Iterator i, Env& env) const
+{
+    const Atom*    value   = i->car()->eval(env);
+    const Promise* promise = dynamic_cast<const Promise*>(value);
+    return (promise != 0) ? promise->force(env) : value;
+}
+
+const Atom* Node::evalConsStream(Node::Iterator i, Env& env) const
+{
+    const Atom* car = (i++)->car()->eval(env);
+    const Atom* cdr = (i++)->car();
+    return new Node(car, new Node(new Promise(cdr, env), getNull()));
+}
+
+const Atom* Node::evalDefineMacro(Node::Iterator i, Env& env) const
+{
+    const Symbol*   s           = (i++)->car()->as<Symbol>();
+    const Function* transformer = (i++)->car()->eval(env)->as<Function>();
+    const Macro*    macro       = new Transformer(transformer);
+    env.push(s->value(), macro);
+    return macro;
+}
+
+const Atom* Node::evalDefineSyntax(Node::Iterator i, Env& env) const
+{
+    const Symbol* s     = (i++)->car()->as<Symbol>();
+    const Macro*  macro = new SyntaxRules((i++)->car()->as<Node>());
+    env.push(s->value(), macro);
+    return macro;
+}
+
+// A form is expanded the first time it is evaluated. The expansion is
+// kept together with the macro that produced it and reused for as long
+// as the head of the form still names that macro.
+const Atom* Node::evalMacro(const Macro* macro, Env& env) const
+{
+    if((expansion_ == 0) || (expansion_->car_ != macro))
+    {
+        expansion_ = new Node(macro, new Node(macro->expand(this, env), getNull()));
+    }
+    return expansion_->cdr_->car_->eval(env);
+}
+
 const Atom* Node::evalFunction(const Function* fun, Env& env) const
 {
-    int i = 0;
-    const Node* args = fun->args();
-    for(Node::Iterator a(args), v(this); a.good(); ++a, ++v)
+    Frame frame(fun, env);
+    for(Node::Iterator v(this); frame.accepts(*v); ++v)
+    {
+        frame.push(v->car()->eval(env));
+    }
+    return fun->call(frame, this);
+}
+
+Promise::Promise(const Atom* exp, const Env& env) : exp_(exp), value_(0)
+{
+    capture(exp, env);
+    pool_.push_back(this);
+}
+
+Promise::Promise() : exp_(0), value_(0)
+{
+    pool_.push_back(this);
+}
+
+void Promise::write(std::ostream& out) const
+{
+    out << "promise";
+}
+
+const Promise* Promise::eval(Env&) const
+{
+    return this;
+}
+
+const Atom* Promise::force(Env& env) const
+{
+    if(value_ == 0)
     {
-        ++i;
-        const std::string& s = a->car()->as<Symbol>()->value();
-        if(s == " ")
+        value_ = compute(env);
+    }
+    return value_;
+}
+
+const Atom* Promise::compute(Env& env) const
+{
+    struct Scope
+    {
+        Scope(Env& env, const Env::Dictionary& bindings) : env_(env), n_(0)
+        {
+            for(Env::Dictionary::const_iterator i = bindings.begin(); i != bindings.end(); ++i, ++n_)
+            {
+                env_.push(i->first, i->second);
+            }
+        }
+
+        ~Scope()
         {
-            env.push(s, *v);
-            break;
+            for(; n_ > 0; --n_)
+            {
+                env_.pop();
+            }
+        }
+
+        Env& env_;
+        int  n_;
+    };
+
+    Scope scope(env, captured_);
+    return exp_->eval(env);
+}
+
+// Lambdas see the bindings of their caller, so a delayed expression
+// keeps the values its free symbols had when the promise was made.
+void Promise::capture(const Atom* exp, const Env& env)
+{
+    if(const Symbol* symbol = dynamic_cast<const Symbol*>(exp))
+    {
+        for(Env::Dictionary::const_iterator i = captured_.begin(); i != captured_.end(); ++i)
+        {
+            if(i->first == symbol->value())
+            {
+                return;
+            }
+        }
+        const Atom* value = env.lookup(symbol->value());
+        if(value != 0)
+        {
+            captured_.push_back(std::make_pair(symbol->value(), value));
         }
-        env.push(s, v->car()->eval(env));
     }
-    const Atom* result = fun->eval(env);
-    while(i > 0)
+    for(Node::Iterator i(dynamic_cast<const Node*>(exp)); i.good(); ++i)
     {
-        env.pop();
-        --i;
+        capture(i->car(), env);
     }
+}
 
-    return result;
+Frame::Frame(const Function* function, Env& env) : function_(function), env_(env), param_(function->args()), pending_(0), pushed_(0)
+{
+}
+
+Frame::~Frame()
+{
+    while(pushed_ > 0)
+    {
+        env_.pop();
+        --pushed_;
+    }
+}
+
+Env& Frame::env() const
+{
+    return env_;
+}
+
+bool Frame::variadic() const
+{
+    return param_.good() && (param_->car()->as<Symbol>()->value() == " ");
+}
+
+bool Frame::accepts(const Node* rest)
+{
+    if( ! param_.good())
+    {
+        return false;
+    }
+    if(variadic())
+    {
+        push(rest);
+        return false;
+    }
+    return true;
+}
+
+void Frame::push(const Atom* value)
+{
+    Binding binding(&param_->car()->as<Symbol>()->value(), value);
+    if(pending_ < Inline)
+    {
+        inline_[pending_] = binding;
+    }
+    else
+    {
+        spilled_.push_back(binding);
+    }
+    ++pending_;
+    ++param_;
+}
+
+int Frame::arguments() const
+{
+    return pending_;
+}
+
+const Atom* Frame::argument(int i) const
+{
+    return ((i < Inline) ? inline_[i] : spilled_[i - Inline]).second;
+}
+
+const Atom* Frame::invoke()
+{
+    for(; pushed_ < pending_; ++pushed_)
+    {
+        const Binding& binding = (pushed_ < Inline) ? inline_[pushed_] : spilled_[pushed_ - Inline];
+        env_.push(*binding.first, binding.second);
+    }
+    return function_->eval(env_);
 }
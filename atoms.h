@@ -1,28 +1,77 @@
 #ifndef ATOMS_H
 #define ATOMS_H
 
+#include <cstddef>
 #include <iosfwd>
 #include <list>
 #include <string>
+#include <utility>
+#include <vector>
 
 class Atom;
+class NodeHeap;
+
+// Owns every atom until Atom::releaseAll(). While a thread is attached to
+// a ThreadHeap, its atoms are registered there instead.
+class Pool
+{
+public:
+    typedef std::vector<const Atom*>::const_iterator const_iterator;
+
+    void push_back(const Atom* atom);
+    std::size_t size() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    friend class ThreadHeap;
+
+    std::vector<const Atom*> atoms_;
+};
+
+// Private atom registry and list cells for a worker thread, so that
+// threads can build atoms side by side without locking. Destroying it
+// hands everything over to the shared pool and heap, so that must happen
+// on one thread at a time (e.g. after joining the workers).
+class ThreadHeap
+{
+public:
+    ThreadHeap();
+    ~ThreadHeap();
+    void attach();
+    void detach();
+
+private:
+    ThreadHeap(const ThreadHeap&);
+    ThreadHeap& operator = (const ThreadHeap&);
+
+    std::vector<const Atom*> atoms_;
+    NodeHeap*                nodes_;
+};
 
 class Env
 {
 public:
     typedef std::list<std::pair<std::string, const Atom*> > Dictionary;
 
+    // keys not bound here are looked up in the parent
+    explicit Env(const Env* parent = 0);
+
     void push(const std::string& key, const Atom* value);
     void pop();
     const Atom* find(const std::string& key) const;
+    const Atom* lookup(const std::string& key) const;
+    const Dictionary& dictionary() const;
 
 private:
     class Matcher;
 
+    const Env* parent_;
     Dictionary dictionary_;
 };
 
 class Node;
+class Frame;
 
 class Atom
 {
@@ -32,14 +81,18 @@ public:
     virtual void write(std::ostream& out) const = 0;
     virtual const Atom* eval(Env& env) const = 0;
     virtual const Atom* evalList(const Node* node, Env& env) const;
+    template<class T> const T* as() const;
 
     static void releaseAll();
+    static std::size_t allocated();
 
 protected:
+    friend class ThreadHeap;
+
+    static void assert_(bool cond, const char* message);
     static void assert_(bool cond, const std::string& message);
-    template<class T> const T* as() const;
 
-    static std::list<const Atom*> pool_;
+    static Pool pool_;
 };
 
 std::ostream& operator << (std::ostream& out, const Atom& atom);
@@ -55,13 +108,13 @@ const T* Atom::as() const
 class Integer : public Atom
 {
 public:
-    Integer(int i);
+    Integer(long long i);
     void write(std::ostream& out) const;
     const Atom* eval(Env& env) const;
-    int value() const;
+    long long value() const;
 
 private:
-    const int i_;
+    const long long i_;
 };
 
 class Real : public Atom
@@ -107,21 +160,37 @@ public:
     Function(const Node* args);
     void write(std::ostream& out) const;
     const Atom* evalList(const Node* node, Env& env) const;
+    virtual const Atom* call(Frame& frame, const Node* site) const;
     const Node* args() const;
 
 private:
     const Node* args_;
 };
 
+class Macro : public Atom
+{
+public:
+    void write(std::ostream& out) const;
+    const Macro* eval(Env& env) const;
+    const Atom* evalList(const Node* node, Env& env) const;
+    virtual const Atom* expand(const Node* form, Env& env) const = 0;
+};
+
+class NativeCode;
+
 class Lambda : public Function
 {
 public:
     Lambda(const Node* args, const Node* exp);
+    ~Lambda();
     void write(std::ostream& out) const;
     const Atom* eval(Env& env) const;
+    const Node* exp() const;
 
 private:
     const Node* exp_;
+    mutable int calls_;
+    mutable const NativeCode* native_;
 };
 
 class Node : public Atom
@@ -144,14 +213,20 @@ public:
     };
 
     static const Node* getNull();
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p, std::size_t size);
 
     Node(const Atom* atom, const Node* next);
     void write(std::ostream& out) const;
     const Atom* car() const;
     const Node* cdr() const;
+    int length() const;
+    int feedback() const;
+    void feedback(int kind) const;
     const Atom* eval(Env& env) const;
     const Atom* evalSymbol(const Symbol* symbol, Env& env) const;
     const Atom* evalFunction(const Function* function, Env& env) const;
+    const Atom* evalMacro(const Macro* macro, Env& env) const;
 
 private:
     Node();
@@ -162,9 +237,70 @@ private:
     const Atom* evalDefine(Iterator i, Env& env) const;
     const Atom* evalLambda(Iterator i, Env& env) const;
     const Atom* evalBegin(Iterator i, Env& env) const;
+    const Atom* evalDelay(Iterator i, Env& env) const;
+    const Atom* evalForce(Iterator i, Env& env) const;
+    const Atom* evalConsStream(Iterator i, Env& env) const;
+    const Atom* evalDefineMacro(Iterator i, Env& env) const;
+    const Atom* evalDefineSyntax(Iterator i, Env& env) const;
 
     const Atom* car_;
     const Node* cdr_;
+    const int   length_;
+    mutable unsigned char feedback_;    // argument types seen when this is the cdr of a primitive call
+    mutable const Node* expansion_;     // ( macro expansion ) when this is the cdr of a macro use
+};
+
+class Promise : public Atom
+{
+public:
+    Promise(const Atom* exp, const Env& env);
+    void write(std::ostream& out) const;
+    const Promise* eval(Env& env) const;
+    const Atom* force(Env& env) const;
+
+protected:
+    Promise();
+    virtual const Atom* compute(Env& env) const;
+
+private:
+    void capture(const Atom* exp, const Env& env);
+
+    const Atom*         exp_;
+    Env::Dictionary     captured_;
+    mutable const Atom* value_;
+};
+
+// Binds the arguments of one call. Pushed values are held back until
+// invoke(), so every argument is evaluated in the caller's scope.
+// Primitives may read them with argument() without binding them.
+class Frame
+{
+public:
+    Frame(const Function* function, Env& env);
+    ~Frame();
+    Env& env() const;
+    bool variadic() const;
+    bool accepts(const Node* rest);
+    void push(const Atom* value);
+    int arguments() const;
+    const Atom* argument(int i) const;
+    const Atom* invoke();
+
+private:
+    typedef std::pair<const std::string*, const Atom*> Binding;
+
+    static const int Inline = 8;
+
+    Frame(const Frame&);
+    Frame& operator = (const Frame&);
+
+    const Function*      function_;
+    Env&                 env_;
+    Node::Iterator       param_;
+    int                  pending_;
+    int                  pushed_;
+    Binding              inline_[Inline];
+    std::vector<Binding> spilled_;
 };
 
 #endif//ATOMS_H
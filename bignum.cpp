@@ -0,0 +1,479 @@
+#include "bignum.h"
+
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+
+namespace
+{
+
+// below this many limbs Karatsuba costs more than it saves
+const std::size_t KaratsubaThreshold = 32;
+
+const unsigned int       DecimalBase   = 1000000000;
+const int                DecimalDigits = 9;
+const unsigned long long LimbBase      = 1ULL << 32;
+
+} // end of anonymous namespace
+
+BigInteger::BigInteger(long long i) : negative_(i < 0)
+{
+    unsigned long long magnitude = negative_ ? 0ULL - static_cast<unsigned long long>(i) : static_cast<unsigned long long>(i);
+    while(magnitude != 0)
+    {
+        limbs_.push_back(static_cast<unsigned int>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInteger::BigInteger(const std::string& digits) : negative_(false)
+{
+    std::string::size_type begin = 0;
+    if(( ! digits.empty()) && ((digits[0] == '-') || (digits[0] == '+')))
+    {
+        negative_ = (digits[0] == '-');
+        begin = 1;
+    }
+    if((begin == digits.size()) || (digits.find_first_not_of("0123456789", begin) != std::string::npos))
+    {
+        throw std::runtime_error("invalid integer " + digits);
+    }
+
+    for(std::string::size_type i = begin; i < digits.size(); i += DecimalDigits)
+    {
+        std::string::size_type n = std::min<std::string::size_type>(DecimalDigits, digits.size() - i);
+        unsigned long long scale = 1;
+        unsigned long long chunk = 0;
+        for(std::string::size_type j = i; j < i + n; ++j)
+        {
+            scale *= 10;
+            chunk = chunk * 10 + (digits[j] - '0');
+        }
+
+        unsigned long long carry = chunk;
+        for(Limbs::iterator limb = limbs_.begin(); limb != limbs_.end(); ++limb)
+        {
+            unsigned long long t = *limb * scale + carry;
+            *limb = static_cast<unsigned int>(t);
+            carry = t >> 32;
+        }
+        if(carry != 0)
+        {
+            limbs_.push_back(static_cast<unsigned int>(carry));
+        }
+    }
+    trim(limbs_);
+    negative_ = negative_ && ! limbs_.empty();
+}
+
+BigInteger::BigInteger(bool negative, const Limbs& limbs) : negative_(negative), limbs_(limbs)
+{
+    trim(limbs_);
+    negative_ = negative_ && ! limbs_.empty();
+}
+
+bool BigInteger::negative() const
+{
+    return negative_;
+}
+
+const BigInteger::Limbs& BigInteger::limbs() const
+{
+    return limbs_;
+}
+
+bool BigInteger::fitsFixnum() const
+{
+    if(limbs_.size() <= 1)
+    {
+        return true;
+    }
+    if(limbs_.size() > 2)
+    {
+        return false;
+    }
+    unsigned long long magnitude = (static_cast<unsigned long long>(limbs_[1]) << 32) | limbs_[0];
+    return magnitude <= (negative_ ? (1ULL << 63) : (1ULL << 63) - 1);
+}
+
+long long BigInteger::toFixnum() const
+{
+    unsigned long long magnitude = 0;
+    for(std::size_t i = limbs_.size(); i > 0; --i)
+    {
+        magnitude = (magnitude << 32) | limbs_[i - 1];
+    }
+    return negative_ ? static_cast<long long>(0ULL - magnitude) : static_cast<long long>(magnitude);
+}
+
+double BigInteger::toDouble() const
+{
+    double result = 0;
+    for(std::size_t i = limbs_.size(); i > 0; --i)
+    {
+        result = result * static_cast<double>(LimbBase) + limbs_[i - 1];
+    }
+    return negative_ ? -result : result;
+}
+
+std::string BigInteger::toString() const
+{
+    if(limbs_.empty())
+    {
+        return "0";
+    }
+
+    std::vector<unsigned int> chunks;
+    Limbs magnitude(limbs_);
+    while( ! magnitude.empty())
+    {
+        chunks.push_back(divideSmall(magnitude, DecimalBase));
+    }
+
+    std::string result(negative_ ? "-" : "");
+    for(std::size_t i = chunks.size(); i > 0; --i)
+    {
+        char buffer[DecimalDigits];
+        unsigned int chunk = chunks[i - 1];
+        int n = 0;
+        do
+        {
+            buffer[n++] = static_cast<char>('0' + chunk % 10);
+            chunk /= 10;
+        }
+        while((i == chunks.size()) ? (chunk != 0) : (n < DecimalDigits));
+        while(n > 0)
+        {
+            result += buffer[--n];
+        }
+    }
+    return result;
+}
+
+BigInteger operator + (const BigInteger& lhs, const BigInteger& rhs)
+{
+    if(lhs.negative_ == rhs.negative_)
+    {
+        return BigInteger(lhs.negative_, BigInteger::add(lhs.limbs_, rhs.limbs_));
+    }
+    if(BigInteger::compare(lhs.limbs_, rhs.limbs_) >= 0)
+    {
+        return BigInteger(lhs.negative_, BigInteger::subtract(lhs.limbs_, rhs.limbs_));
+    }
+    return BigInteger(rhs.negative_, BigInteger::subtract(rhs.limbs_, lhs.limbs_));
+}
+
+BigInteger operator - (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return lhs + BigInteger( ! rhs.negative_, rhs.limbs_);
+}
+
+BigInteger operator * (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger(lhs.negative_ != rhs.negative_, BigInteger::karatsuba(lhs.limbs_, rhs.limbs_));
+}
+
+// truncates toward zero like the fixnum division
+BigInteger operator / (const BigInteger& lhs, const BigInteger& rhs)
+{
+    if(rhs.limbs_.empty())
+    {
+        throw std::runtime_error("division by zero");
+    }
+    return BigInteger(lhs.negative_ != rhs.negative_, BigInteger::divide(lhs.limbs_, rhs.limbs_));
+}
+
+bool operator == (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger::signedCompare(lhs, rhs) == 0;
+}
+
+bool operator < (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger::signedCompare(lhs, rhs) < 0;
+}
+
+bool operator > (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger::signedCompare(lhs, rhs) > 0;
+}
+
+bool operator <= (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger::signedCompare(lhs, rhs) <= 0;
+}
+
+bool operator >= (const BigInteger& lhs, const BigInteger& rhs)
+{
+    return BigInteger::signedCompare(lhs, rhs) >= 0;
+}
+
+int BigInteger::signedCompare(const BigInteger& lhs, const BigInteger& rhs)
+{
+    if(lhs.negative_ != rhs.negative_)
+    {
+        return lhs.negative_ ? -1 : 1;
+    }
+    int result = compare(lhs.limbs_, rhs.limbs_);
+    return lhs.negative_ ? -result : result;
+}
+
+int BigInteger::compare(const Limbs& lhs, const Limbs& rhs)
+{
+    if(lhs.size() != rhs.size())
+    {
+        return (lhs.size() < rhs.size()) ? -1 : 1;
+    }
+    for(std::size_t i = lhs.size(); i > 0; --i)
+    {
+        if(lhs[i - 1] != rhs[i - 1])
+        {
+            return (lhs[i - 1] < rhs[i - 1]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+BigInteger::Limbs BigInteger::add(const Limbs& lhs, const Limbs& rhs)
+{
+    const Limbs& longer  = (lhs.size() >= rhs.size()) ? lhs : rhs;
+    const Limbs& shorter = (lhs.size() >= rhs.size()) ? rhs : lhs;
+    Limbs result(longer.size() + 1, 0);
+    unsigned long long carry = 0;
+    for(std::size_t i = 0; i < longer.size(); ++i)
+    {
+        carry += static_cast<unsigned long long>(longer[i]) + ((i < shorter.size()) ? shorter[i] : 0);
+        result[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+    result[longer.size()] = static_cast<unsigned int>(carry);
+    trim(result);
+    return result;
+}
+
+// requires lhs >= rhs
+BigInteger::Limbs BigInteger::subtract(const Limbs& lhs, const Limbs& rhs)
+{
+    Limbs result(lhs.size(), 0);
+    long long borrow = 0;
+    for(std::size_t i = 0; i < lhs.size(); ++i)
+    {
+        long long t = static_cast<long long>(lhs[i]) - ((i < rhs.size()) ? rhs[i] : 0) - borrow;
+        borrow = (t < 0) ? 1 : 0;
+        result[i] = static_cast<unsigned int>(t + (borrow << 32));
+    }
+    trim(result);
+    return result;
+}
+
+BigInteger::Limbs BigInteger::multiply(const Limbs& lhs, const Limbs& rhs)
+{
+    if(lhs.empty() || rhs.empty())
+    {
+        return Limbs();
+    }
+    Limbs result(lhs.size() + rhs.size(), 0);
+    for(std::size_t i = 0; i < lhs.size(); ++i)
+    {
+        unsigned long long carry = 0;
+        for(std::size_t j = 0; j < rhs.size(); ++j)
+        {
+            unsigned long long t = static_cast<unsigned long long>(lhs[i]) * rhs[j] + result[i + j] + carry;
+            result[i + j] = static_cast<unsigned int>(t);
+            carry = t >> 32;
+        }
+        result[i + rhs.size()] = static_cast<unsigned int>(carry);
+    }
+    trim(result);
+    return result;
+}
+
+// (a1 B + a0)(b1 B + b0) = a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0
+BigInteger::Limbs BigInteger::karatsuba(const Limbs& lhs, const Limbs& rhs)
+{
+    if((lhs.size() < KaratsubaThreshold) || (rhs.size() < KaratsubaThreshold))
+    {
+        return multiply(lhs, rhs);
+    }
+
+    std::size_t m = std::max(lhs.size(), rhs.size()) / 2;
+    Limbs a0(lhs.begin(), lhs.begin() + std::min(m, lhs.size()));
+    Limbs a1(lhs.begin() + std::min(m, lhs.size()), lhs.end());
+    Limbs b0(rhs.begin(), rhs.begin() + std::min(m, rhs.size()));
+    Limbs b1(rhs.begin() + std::min(m, rhs.size()), rhs.end());
+    trim(a0);
+    trim(b0);
+
+    Limbs z0 = karatsuba(a0, b0);
+    Limbs z2 = karatsuba(a1, b1);
+    Limbs z1 = subtract(subtract(karatsuba(add(a0, a1), add(b0, b1)), z0), z2);
+
+    Limbs result(z0);
+    addShifted(result, z1, m);
+    addShifted(result, z2, 2 * m);
+    trim(result);
+    return result;
+}
+
+void BigInteger::addShifted(Limbs& result, const Limbs& value, std::size_t shift)
+{
+    if(value.empty())
+    {
+        return;
+    }
+    if(result.size() < shift + value.size() + 1)
+    {
+        result.resize(shift + value.size() + 1, 0);
+    }
+    unsigned long long carry = 0;
+    std::size_t i = 0;
+    for(; i < value.size(); ++i)
+    {
+        carry += static_cast<unsigned long long>(result[shift + i]) + value[i];
+        result[shift + i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+    for(i += shift; carry != 0; ++i)
+    {
+        if(i == result.size())
+        {
+            result.push_back(0);
+        }
+        carry += result[i];
+        result[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+}
+
+// divides in place and returns the remainder
+unsigned int BigInteger::divideSmall(Limbs& limbs, unsigned int divisor)
+{
+    unsigned long long remainder = 0;
+    for(std::size_t i = limbs.size(); i > 0; --i)
+    {
+        unsigned long long t = (remainder << 32) | limbs[i - 1];
+        limbs[i - 1] = static_cast<unsigned int>(t / divisor);
+        remainder = t % divisor;
+    }
+    trim(limbs);
+    return static_cast<unsigned int>(remainder);
+}
+
+// Knuth's algorithm D: normalizes so that the divisor's top limb has its
+// high bit set, which keeps every estimated quotient limb at most two off.
+BigInteger::Limbs BigInteger::divide(const Limbs& lhs, const Limbs& rhs)
+{
+    if(compare(lhs, rhs) < 0)
+    {
+        return Limbs();
+    }
+    if(rhs.size() == 1)
+    {
+        Limbs quotient(lhs);
+        divideSmall(quotient, rhs[0]);
+        return quotient;
+    }
+
+    int s = __builtin_clz(rhs.back());
+    std::size_t n = rhs.size();
+    std::size_t m = lhs.size() - n;
+
+    Limbs v(n);
+    for(std::size_t i = n - 1; i > 0; --i)
+    {
+        v[i] = (rhs[i] << s) | ((s == 0) ? 0 : (rhs[i - 1] >> (32 - s)));
+    }
+    v[0] = rhs[0] << s;
+
+    Limbs u(lhs.size() + 1);
+    u[lhs.size()] = (s == 0) ? 0 : (lhs.back() >> (32 - s));
+    for(std::size_t i = lhs.size() - 1; i > 0; --i)
+    {
+        u[i] = (lhs[i] << s) | ((s == 0) ? 0 : (lhs[i - 1] >> (32 - s)));
+    }
+    u[0] = lhs[0] << s;
+
+    Limbs quotient(m + 1, 0);
+    for(std::size_t j = m + 1; j > 0; --j)
+    {
+        std::size_t k = j - 1;
+        unsigned long long numerator = (static_cast<unsigned long long>(u[k + n]) << 32) | u[k + n - 1];
+        unsigned long long qhat = numerator / v[n - 1];
+        unsigned long long rhat = numerator % v[n - 1];
+        while((qhat >= LimbBase) || (qhat * v[n - 2] > ((rhat << 32) | u[k + n - 2])))
+        {
+            --qhat;
+            rhat += v[n - 1];
+            if(rhat >= LimbBase)
+            {
+                break;
+            }
+        }
+
+        long long borrow = 0;
+        long long t      = 0;
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            unsigned long long p = qhat * v[i];
+            t = static_cast<long long>(u[i + k]) - borrow - static_cast<long long>(p & 0xffffffffULL);
+            u[i + k] = static_cast<unsigned int>(t);
+            borrow = static_cast<long long>(p >> 32) - (t >> 32);
+        }
+        t = static_cast<long long>(u[k + n]) - borrow;
+        u[k + n] = static_cast<unsigned int>(t);
+
+        quotient[k] = static_cast<unsigned int>(qhat);
+        if(t < 0)
+        {
+            // the estimate was one too large: add the divisor back
+            --quotient[k];
+            unsigned long long carry = 0;
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                carry += static_cast<unsigned long long>(u[i + k]) + v[i];
+                u[i + k] = static_cast<unsigned int>(carry);
+                carry >>= 32;
+            }
+            u[k + n] += static_cast<unsigned int>(carry);
+        }
+    }
+    trim(quotient);
+    return quotient;
+}
+
+void BigInteger::trim(Limbs& limbs)
+{
+    while(( ! limbs.empty()) && (limbs.back() == 0))
+    {
+        limbs.pop_back();
+    }
+}
+
+const Atom* Bignum::create(const BigInteger& value)
+{
+    if(value.fitsFixnum())
+    {
+        return new Integer(value.toFixnum());
+    }
+    return new Bignum(value);
+}
+
+Bignum::Bignum(const BigInteger& value) : value_(value)
+{
+    pool_.push_back(this);
+}
+
+void Bignum::write(std::ostream& out) const
+{
+    out << value_.toString();
+}
+
+const Bignum* Bignum::eval(Env& env) const
+{
+    return this;
+}
+
+const BigInteger& Bignum::value() const
+{
+    return value_;
+}
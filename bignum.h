@@ -0,0 +1,68 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include "atoms.h"
+
+#include <string>
+#include <vector>
+
+// Arbitrary precision integer: a sign and a little-endian magnitude in
+// 32-bit limbs without leading zeros (zero has no limbs).
+class BigInteger
+{
+public:
+    typedef std::vector<unsigned int> Limbs;
+
+    BigInteger(long long i = 0);
+    explicit BigInteger(const std::string& digits);
+    BigInteger(bool negative, const Limbs& limbs);
+
+    bool negative() const;
+    const Limbs& limbs() const;
+    bool fitsFixnum() const;
+    long long toFixnum() const;
+    double toDouble() const;
+    std::string toString() const;
+
+    friend BigInteger operator + (const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator - (const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator * (const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator / (const BigInteger& lhs, const BigInteger& rhs);
+    friend bool operator == (const BigInteger& lhs, const BigInteger& rhs);
+    friend bool operator <  (const BigInteger& lhs, const BigInteger& rhs);
+    friend bool operator >  (const BigInteger& lhs, const BigInteger& rhs);
+    friend bool operator <= (const BigInteger& lhs, const BigInteger& rhs);
+    friend bool operator >= (const BigInteger& lhs, const BigInteger& rhs);
+
+private:
+    static int compare(const Limbs& lhs, const Limbs& rhs);
+    static Limbs add(const Limbs& lhs, const Limbs& rhs);
+    static Limbs subtract(const Limbs& lhs, const Limbs& rhs);
+    static Limbs multiply(const Limbs& lhs, const Limbs& rhs);
+    static Limbs karatsuba(const Limbs& lhs, const Limbs& rhs);
+    static Limbs divide(const Limbs& lhs, const Limbs& rhs);
+    static unsigned int divideSmall(Limbs& limbs, unsigned int divisor);
+    static void addShifted(Limbs& result, const Limbs& value, std::size_t shift);
+    static void trim(Limbs& limbs);
+    static int signedCompare(const BigInteger& lhs, const BigInteger& rhs);
+
+    bool  negative_;
+    Limbs limbs_;
+};
+
+class Bignum : public Atom
+{
+public:
+    static const Atom* create(const BigInteger& value);
+
+    void write(std::ostream& out) const;
+    const Bignum* eval(Env& env) const;
+    const BigInteger& value() const;
+
+private:
+    Bignum(const BigInteger& value);
+
+    const BigInteger value_;
+};
+
+#endif//BIGNUM_H
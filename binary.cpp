@@ -0,0 +1,444 @@
+#include "binary.h"
+#include "atoms.h"
+#include "bignum.h"
+
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+const char Magic[] = "liscpp-sexp-1";
+
+enum Tag { ListTag, IntegerTag, RealTag, FalseTag, TrueTag, SymbolTag, SymbolRefTag, BignumTag };
+
+// Lists are written as their length followed by their elements, so a
+// reader never has to look for a closing delimiter. The first occurrence
+// of a symbol carries its name; later ones refer to it by number.
+class Encoder
+{
+public:
+    explicit Encoder(BinaryWriter& out) : out_(out)
+    {
+    }
+
+    // nested lists are walked with an explicit stack, so the depth of the
+    // data does not matter
+    void encode(const Atom* atom)
+    {
+        std::vector<Node::Iterator> pending;
+        for(;;)
+        {
+            if(const Node* node = dynamic_cast<const Node*>(atom))
+            {
+                std::size_t n = 0;
+                for(Node::Iterator i(node); i.good(); ++i)
+                {
+                    ++n;
+                }
+                out_.byte(ListTag);
+                out_.varint(n);
+                pending.push_back(Node::Iterator(node));
+            }
+            else
+            {
+                leaf(atom);
+            }
+
+            while(( ! pending.empty()) && ( ! pending.back().good()))
+            {
+                pending.pop_back();
+            }
+            if(pending.empty())
+            {
+                return;
+            }
+            atom = (pending.back()++)->car();
+        }
+    }
+
+private:
+    void leaf(const Atom* atom)
+    {
+        if(const Integer* i = dynamic_cast<const Integer*>(atom))
+        {
+            out_.byte(IntegerTag);
+            out_.integer(i->value());
+        }
+        else if(const Bignum* n = dynamic_cast<const Bignum*>(atom))
+        {
+            out_.byte(BignumTag);
+            out_.bignum(n->value());
+        }
+        else if(const Real* r = dynamic_cast<const Real*>(atom))
+        {
+            out_.byte(RealTag);
+            out_.real(r->value());
+        }
+        else if(const Bool* b = dynamic_cast<const Bool*>(atom))
+        {
+            out_.byte(b->value() ? TrueTag : FalseTag);
+        }
+        else if(const Symbol* s = dynamic_cast<const Symbol*>(atom))
+        {
+            std::map<std::string, std::size_t>::const_iterator found = symbols_.find(s->value());
+            if(found == symbols_.end())
+            {
+                std::size_t id = symbols_.size();
+                symbols_[s->value()] = id;
+                out_.byte(SymbolTag);
+                out_.string(s->value());
+            }
+            else
+            {
+                out_.byte(SymbolRefTag);
+                out_.varint(found->second);
+            }
+        }
+        else
+        {
+            std::stringstream ss;
+            ss << *atom;
+            throw std::runtime_error("cannot write " + ss.str());
+        }
+    }
+
+    BinaryWriter&                      out_;
+    std::map<std::string, std::size_t> symbols_;
+};
+
+class Decoder
+{
+public:
+    explicit Decoder(BinaryReader& in) : in_(in)
+    {
+    }
+
+    const Atom* decode()
+    {
+        // lists still missing elements, innermost last
+        std::deque<Pending> pending;
+        for(;;)
+        {
+            const Atom* atom = Node::getNull();
+            unsigned char tag = in_.byte();
+            if(tag == ListTag)
+            {
+                std::size_t n = in_.count();
+                if(n > 0)
+                {
+                    pending.push_back(Pending());
+                    pending.back().missing = n;
+                    continue;
+                }
+            }
+            else
+            {
+                atom = leaf(tag);
+            }
+
+            for(;;)
+            {
+                if(pending.empty())
+                {
+                    return atom;
+                }
+                Pending& list = pending.back();
+                list.atoms.push_back(atom);
+                if(--list.missing > 0)
+                {
+                    break;
+                }
+                const Node* node = Node::getNull();
+                for(std::vector<const Atom*>::reverse_iterator i = list.atoms.rbegin(); i != list.atoms.rend(); ++i)
+                {
+                    node = new Node(*i, node);
+                }
+                atom = node;
+                pending.pop_back();
+            }
+        }
+    }
+
+private:
+    struct Pending
+    {
+        std::size_t              missing;
+        std::vector<const Atom*> atoms;
+    };
+
+    const Atom* leaf(unsigned char tag)
+    {
+        switch(tag)
+        {
+        case IntegerTag:
+            return new Integer(in_.integer());
+
+        case BignumTag:
+            return Bignum::create(in_.bignum());
+
+        case RealTag:
+            return new Real(in_.real());
+
+        case FalseTag:
+            return new Bool(false);
+
+        case TrueTag:
+            return new Bool(true);
+
+        case SymbolTag:
+            symbols_.push_back(new Symbol(in_.string()));
+            return symbols_.back();
+
+        case SymbolRefTag:
+            {
+                std::size_t id = in_.varint();
+                if(id >= symbols_.size())
+                {
+                    throw std::runtime_error("malformed binary data");
+                }
+                return symbols_[id];
+            }
+
+        default:
+            throw std::runtime_error("malformed binary data");
+        }
+    }
+
+    BinaryReader&              in_;
+    std::vector<const Symbol*> symbols_;
+};
+
+} // end of anonymous namespace
+
+void BinaryWriter::raw(const char* data, std::size_t n)
+{
+    data_.append(data, n);
+}
+
+void BinaryWriter::byte(unsigned char b)
+{
+    data_ += static_cast<char>(b);
+}
+
+void BinaryWriter::varint(unsigned long long v)
+{
+    while(v >= 0x80)
+    {
+        byte(static_cast<unsigned char>(v | 0x80));
+        v >>= 7;
+    }
+    byte(static_cast<unsigned char>(v));
+}
+
+void BinaryWriter::integer(long long i)
+{
+    varint((static_cast<unsigned long long>(i) << 1) ^ static_cast<unsigned long long>(i >> 63));
+}
+
+void BinaryWriter::bignum(const BigInteger& n)
+{
+    byte(n.negative() ? 1 : 0);
+    varint(n.limbs().size());
+    for(BigInteger::Limbs::const_iterator i = n.limbs().begin(); i != n.limbs().end(); ++i)
+    {
+        varint(*i);
+    }
+}
+
+void BinaryWriter::real(double r)
+{
+    char bytes[sizeof(double)];
+    std::memcpy(bytes, &r, sizeof(double));
+    raw(bytes, sizeof(double));
+}
+
+void BinaryWriter::string(const std::string& s)
+{
+    varint(s.size());
+    data_ += s;
+}
+
+const std::string& BinaryWriter::data() const
+{
+    return data_;
+}
+
+void BinaryWriter::save(const std::string& path) const
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if( ! file.write(data_.data(), data_.size()))
+    {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+BinaryReader::BinaryReader(const char* begin, const char* end) : cur_(begin), end_(end)
+{
+}
+
+unsigned char BinaryReader::byte()
+{
+    need(1);
+    return static_cast<unsigned char>(*cur_++);
+}
+
+unsigned long long BinaryReader::varint()
+{
+    unsigned long long v = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        unsigned char b = byte();
+        v |= static_cast<unsigned long long>(b & 0x7f) << shift;
+        if((b & 0x80) == 0)
+        {
+            return v;
+        }
+    }
+    throw std::runtime_error("malformed varint");
+}
+
+// a length taken from the data; every counted item takes at least one
+// byte, so a count beyond the remaining input is rejected before anything
+// is allocated for it
+std::size_t BinaryReader::count()
+{
+    unsigned long long n = varint();
+    if(n > static_cast<unsigned long long>(end_ - cur_))
+    {
+        throw std::runtime_error("malformed binary data");
+    }
+    return static_cast<std::size_t>(n);
+}
+
+long long BinaryReader::integer()
+{
+    unsigned long long v = varint();
+    return static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1);
+}
+
+BigInteger BinaryReader::bignum()
+{
+    bool negative = (byte() != 0);
+    BigInteger::Limbs limbs(count());
+    for(BigInteger::Limbs::iterator i = limbs.begin(); i != limbs.end(); ++i)
+    {
+        unsigned long long limb = varint();
+        if(limb > 0xffffffffULL)
+        {
+            throw std::runtime_error("malformed binary data");
+        }
+        *i = static_cast<unsigned int>(limb);
+    }
+    return BigInteger(negative, limbs);
+}
+
+double BinaryReader::real()
+{
+    need(sizeof(double));
+    double r;
+    std::memcpy(&r, cur_, sizeof(double));
+    cur_ += sizeof(double);
+    return r;
+}
+
+std::string BinaryReader::string()
+{
+    std::size_t n = varint();
+    need(n);
+    std::string s(cur_, n);
+    cur_ += n;
+    return s;
+}
+
+bool BinaryReader::good() const
+{
+    return cur_ < end_;
+}
+
+void BinaryReader::need(std::size_t n) const
+{
+    if(static_cast<std::size_t>(end_ - cur_) < n)
+    {
+        throw std::runtime_error("unexpected end of binary data");
+    }
+}
+
+MappedFile::MappedFile(const std::string& path) : data_(0), size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0)
+    {
+        size_ = st.st_size;
+    }
+    if(size_ > 0)
+    {
+        data_ = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(data_ == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot map " + path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if(data_ != 0)
+    {
+        munmap(data_, size_);
+    }
+}
+
+const char* MappedFile::begin() const
+{
+    return static_cast<const char*>(data_);
+}
+
+const char* MappedFile::end() const
+{
+    return begin() + size_;
+}
+
+std::size_t writeBinary(const std::string& path, const Atom* atom)
+{
+    BinaryWriter out;
+    out.raw(Magic, sizeof(Magic));
+    Encoder(out).encode(atom);
+    out.save(path);
+    return out.data().size();
+}
+
+const Atom* readBinary(const std::string& path)
+{
+    MappedFile   file(path);
+    BinaryReader in(file.begin(), file.end());
+    for(const char* c = Magic; c != Magic + sizeof(Magic); ++c)
+    {
+        if(in.byte() != static_cast<unsigned char>(*c))
+        {
+            throw std::runtime_error(path + " is not binary s-expression data");
+        }
+    }
+    const Atom* atom = Decoder(in).decode();
+    if(in.good())
+    {
+        throw std::runtime_error("trailing data after binary s-expression");
+    }
+    return atom;
+}
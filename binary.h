@@ -0,0 +1,67 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <cstddef>
+#include <string>
+
+class Atom;
+class BigInteger;
+
+class BinaryWriter
+{
+public:
+    void raw(const char* data, std::size_t n);
+    void byte(unsigned char b);
+    void varint(unsigned long long v);
+    void integer(long long i);
+    void bignum(const BigInteger& n);
+    void real(double r);
+    void string(const std::string& s);
+
+    const std::string& data() const;
+    void save(const std::string& path) const;
+
+private:
+    std::string data_;
+};
+
+class BinaryReader
+{
+public:
+    BinaryReader(const char* begin, const char* end);
+    unsigned char byte();
+    unsigned long long varint();
+    std::size_t count();
+    long long integer();
+    BigInteger bignum();
+    double real();
+    std::string string();
+    bool good() const;
+
+private:
+    void need(std::size_t n) const;
+
+    const char* cur_;
+    const char* end_;
+};
+
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    const char* begin() const;
+    const char* end() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator = (const MappedFile&);
+
+    void*       data_;
+    std::size_t size_;
+};
+
+std::size_t writeBinary(const std::string& path, const Atom* atom);
+const Atom* readBinary(const std::string& path);
+
+#endif//BINARY_H
@@ -0,0 +1,763 @@
+#include "compiler.h"
+#include "bignum.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <typeinfo>
+#include <vector>
+
+namespace
+{
+
+std::string literal(const std::string& s)
+{
+    std::string result("\"");
+    for(std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+    {
+        if((*i == '"') || (*i == '\\'))
+        {
+            result += '\\';
+            result += *i;
+        }
+        else if(std::isprint(static_cast<unsigned char>(*i)))
+        {
+            result += *i;
+        }
+        else
+        {
+            char buffer[8];
+            std::sprintf(buffer, "\\%03o", static_cast<unsigned char>(*i));
+            result += buffer;
+        }
+    }
+    return result + "\"";
+}
+
+std::string number(int i)
+{
+    std::ostringstream ss;
+    ss << i;
+    return ss.str();
+}
+
+std::vector<const Atom*> elements(const Node* node)
+{
+    std::vector<const Atom*> result;
+    for(Node::Iterator i(node); i.good(); ++i)
+    {
+        result.push_back(i->car());
+    }
+    return result;
+}
+
+enum Kind { Arithmetic, Division, Comparison };
+
+// Primitives whose fixnum case is written out inline. Their other cases
+// go through the primitive itself, as in the interpreter.
+struct Primitive
+{
+    const char* name;
+    Kind        kind;
+    const char* op;
+};
+
+const Primitive primitives[] =
+{
+    { "+",  Arithmetic, "__builtin_add_overflow" },
+    { "-",  Arithmetic, "__builtin_sub_overflow" },
+    { "*",  Arithmetic, "__builtin_mul_overflow" },
+    { "/",  Division,   "/"                      },
+    { "<",  Comparison, "<"                      },
+    { ">",  Comparison, ">"                      },
+    { "<=", Comparison, "<="                     },
+    { ">=", Comparison, ">="                     },
+    { "=",  Comparison, "=="                     },
+};
+
+bool special(const std::string& name)
+{
+    return (name == "quote") || (name == "if") || (name == "set!") || (name == "define") || (name == "lambda") || (name == "begin")
+        || (name == "delay") || (name == "force") || (name == "cons-stream")
+        || (name == "define-macro") || (name == "define-syntax");
+}
+
+// Translates each top-level form into a function and each lambda into a
+// Lambda subclass whose eval() is straight-line C++. The fixnum cases of
+// the arithmetic and comparison primitives are inlined, guarded by one
+// check on entry to each form that their names are still bound to them;
+// when it fails the form and the lambdas are interpreted instead. The
+// parameters of a lambda are kept in C++ locals when no other code can
+// see them through the environment. Other calls go through Frame exactly
+// like Node::evalFunction, so argument binding order and variadic
+// primitives behave as in the interpreter. Forms the translator does not
+// understand are evaluated by the interpreter from a constant.
+class Emitter
+{
+public:
+    explicit Emitter(std::ostream& out) : out_(out), params_(0), constants_(0), lists_(0), lambdas_(0), temps_(0)
+    {
+    }
+
+    void emit(const std::list<const Atom*>& program, const std::string& source)
+    {
+        for(std::list<const Atom*>::const_iterator i = program.begin(); i != program.end(); ++i)
+        {
+            scan(*i, 0, false);
+        }
+
+        std::vector<std::string> forms;
+        int n = 0;
+        for(std::list<const Atom*>::const_iterator i = program.begin(); i != program.end(); ++i, ++n)
+        {
+            forms.push_back(constant(*i));
+            forms_ << "const Atom* form" << n << "(Env& env)\n{\n";
+            forms_ << "    bound = primitivesBound(env);\n";
+            forms_ << "    if( ! bound)\n    {\n        return " << forms.back() << "->eval(env);\n    }\n";
+            std::string result = expression(*i, forms_, "    ");
+            forms_ << "    return " << result << ";\n}\n\n";
+        }
+
+        out_ << "// generated by liscpp --emit-cpp from " << source << "\n\n";
+        out_ << "#include \"atoms.h\"\n";
+        out_ << "#include \"bignum.h\"\n";
+        out_ << "#include \"functions.h\"\n\n";
+        out_ << "#include <cstdlib>\n";
+        out_ << "#include <iostream>\n";
+        out_ << "#include <typeinfo>\n\n";
+        out_ << "namespace\n{\n\n";
+        out_ << "const Atom* constant[" << constants_ + 1 << "];\n";
+        out_ << "const Node* list[" << lists_ + 1 << "];\n\n";
+        out_ << "const char* const primitiveName[] = { ";
+        for(std::vector<int>::const_iterator i = used_.begin(); i != used_.end(); ++i)
+        {
+            out_ << literal(primitives[*i].name) << ", ";
+        }
+        out_ << "0 };\n";
+        out_ << "const Atom* primitive[" << used_.size() + 1 << "];\n";
+        out_ << "bool        bound = false;      // the primitives above still have their names\n\n";
+        out_ << support;
+        out_ << "void initialize(Env& env)\n{\n";
+        out_ << "    for(int i = 0; primitiveName[i] != 0; ++i)\n    {\n        primitive[i] = env.find(primitiveName[i]);\n    }\n";
+        out_ << init_.str() << "}\n\n";
+        out_ << classes_.str();
+        out_ << forms_.str();
+        out_ << "} // end of anonymous namespace\n\n";
+        out_ << "int main(int, char* [])\n{\n";
+        out_ << "    Env env;\n\n";
+        out_ << "    appendFunctions(env);\n";
+        out_ << "    initialize(env);\n\n";
+        for(int i = 0; i < n; ++i)
+        {
+            out_ << "    std::cout << *" << forms[i] << " << \" -> \" << *form" << i << "(env) << std::endl;\n";
+        }
+        out_ << "\n    Atom::releaseAll();\n\n";
+        out_ << "    return 0;\n}\n";
+    }
+
+private:
+    static const char* const support;
+
+    // Records which names other code could reach through the environment:
+    // symbols under quote or in macro definitions, and symbols a lambda
+    // body uses without binding them itself. Names rebound by define,
+    // set! or a parameter list are kept apart for the inlined primitives.
+    void scan(const Atom* atom, const std::set<std::string>* bound, bool quoted)
+    {
+        if(const Symbol* symbol = dynamic_cast<const Symbol*>(atom))
+        {
+            if(quoted || ((bound != 0) && (bound->count(symbol->value()) == 0)))
+            {
+                free_.insert(symbol->value());
+            }
+            return;
+        }
+
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if((node == 0) || (node == Node::getNull()))
+        {
+            return;
+        }
+
+        std::vector<const Atom*> form = elements(node);
+        const Symbol* head = quoted ? 0 : dynamic_cast<const Symbol*>(form[0]);
+        const std::string name = (head != 0) ? head->value() : "";
+        if(((name == "define") || (name == "set!") || (name == "define-macro") || (name == "define-syntax"))
+            && (form.size() >= 2) && (typeid(*form[1]) == typeid(Symbol)))
+        {
+            rebound_.insert(static_cast<const Symbol*>(form[1])->value());
+        }
+        if((name == "quote") || (name == "define-macro") || (name == "define-syntax"))
+        {
+            quoted = true;
+        }
+        else if((name == "lambda") && (form.size() >= 3) && dynamic_cast<const Node*>(form[1]))
+        {
+            std::set<std::string> params;
+            for(Node::Iterator i(static_cast<const Node*>(form[1])); i.good(); ++i)
+            {
+                if(const Symbol* param = dynamic_cast<const Symbol*>(i->car()))
+                {
+                    params.insert(param->value());
+                    rebound_.insert(param->value());
+                }
+            }
+            for(std::size_t i = 2; i < form.size(); ++i)
+            {
+                scan(form[i], &params, false);
+            }
+            return;
+        }
+        for(std::size_t i = (head != 0) ? 1 : 0; i < form.size(); ++i)
+        {
+            scan(form[i], bound, quoted);
+        }
+    }
+
+    // true when the expression compiles to calls, branches and constants
+    // only, so that nothing in it reads the environment by name
+    bool simple(const Atom* atom) const
+    {
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if((node == 0) || (node == Node::getNull()))
+        {
+            return true;
+        }
+
+        std::vector<const Atom*> form = elements(node);
+        const Symbol* head = dynamic_cast<const Symbol*>(form[0]);
+        if((head == 0) || (macros_.count(head->value()) != 0))
+        {
+            return false;
+        }
+
+        const std::string& name = head->value();
+        std::size_t n = form.size();
+        if(name == "quote")
+        {
+            return n >= 2;
+        }
+        if(name == "if")
+        {
+            if(n < 4)
+            {
+                return false;
+            }
+            n = 4;
+        }
+        else if(((name == "begin") && (n < 2)) || ((name != "begin") && special(name)))
+        {
+            return false;
+        }
+        for(std::size_t i = 1; i < n; ++i)
+        {
+            if( ! simple(form[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool localizable(const Node* args, const Atom* exp, std::vector<std::string>& params) const
+    {
+        for(Node::Iterator i(args); i.good(); ++i)
+        {
+            const Symbol* symbol = dynamic_cast<const Symbol*>(i->car());
+            if((symbol == 0) || (free_.count(symbol->value()) != 0) || (std::find(params.begin(), params.end(), symbol->value()) != params.end()))
+            {
+                return false;
+            }
+            params.push_back(symbol->value());
+        }
+        return ! params.empty() && simple(exp);
+    }
+
+    // index into primitive[] of a primitive to inline, or -1
+    int inlined(const std::string& name)
+    {
+        if(rebound_.count(name) != 0)
+        {
+            return -1;
+        }
+        for(int i = 0; i < static_cast<int>(sizeof(primitives) / sizeof(primitives[0])); ++i)
+        {
+            if(name == primitives[i].name)
+            {
+                std::vector<int>::iterator found = std::find(used_.begin(), used_.end(), i);
+                if(found != used_.end())
+                {
+                    return found - used_.begin();
+                }
+                used_.push_back(i);
+                return used_.size() - 1;
+            }
+        }
+        return -1;
+    }
+
+    std::string constant(const Atom* atom)
+    {
+        std::map<const Atom*, std::string>::const_iterator found = names_.find(atom);
+        if(found != names_.end())
+        {
+            return found->second;
+        }
+        if(const Node* node = dynamic_cast<const Node*>(atom))
+        {
+            return chain(node);
+        }
+
+        std::string name = "constant[" + number(constants_++) + "]";
+        init_ << "    " << name << " = ";
+        if(const Integer* i = dynamic_cast<const Integer*>(atom))
+        {
+            init_ << "new Integer(" << fixnum(i->value()) << ");\n";
+        }
+        else if(const Bignum* n = dynamic_cast<const Bignum*>(atom))
+        {
+            init_ << "Bignum::create(BigInteger(std::string(" << literal(n->value().toString()) << ")));\n";
+        }
+        else if(const Real* r = dynamic_cast<const Real*>(atom))
+        {
+            char buffer[32];
+            std::sprintf(buffer, "%.17g", r->value());
+            init_ << "new Real(std::strtod(" << literal(buffer) << ", 0));\n";
+        }
+        else if(const Bool* b = dynamic_cast<const Bool*>(atom))
+        {
+            init_ << "new Bool(" << (b->value() ? "true" : "false") << ");\n";
+        }
+        else
+        {
+            init_ << "new Symbol(" << literal(atom->as<Symbol>()->value()) << ");\n";
+        }
+        return names_[atom] = name;
+    }
+
+    // Builds the list cells not built yet, from the last one. Every cell
+    // of the source is built once and shared by all that refer to it.
+    std::string chain(const Node* node)
+    {
+        std::vector<const Node*> cells;
+        for(Node::Iterator i(node); i.good() && (names_.count(*i) == 0); ++i)
+        {
+            cells.push_back(*i);
+        }
+        for(std::vector<const Node*>::reverse_iterator i = cells.rbegin(); i != cells.rend(); ++i)
+        {
+            std::string car  = constant((*i)->car());
+            std::string cdr  = ((*i)->cdr() == Node::getNull()) ? "Node::getNull()" : names_[(*i)->cdr()];
+            std::string name = "list[" + number(lists_++) + "]";
+            init_ << "    " << name << " = new Node(" << car << ", " << cdr << ");\n";
+            names_[*i] = name;
+        }
+        return (node == Node::getNull()) ? "Node::getNull()" : names_[node];
+    }
+
+    static std::string fixnum(long long value)
+    {
+        // LLONG_MIN has no literal of its own
+        std::ostringstream ss;
+        if(value < -0x7fffffffffffffffLL)
+        {
+            ss << "(" << value + 1 << "LL - 1)";
+        }
+        else
+        {
+            ss << value << "LL";
+        }
+        return ss.str();
+    }
+
+    std::string temp()
+    {
+        return "t" + number(temps_++);
+    }
+
+    std::string fallback(const Atom* atom, std::ostream& body, const std::string& indent)
+    {
+        std::string result = temp();
+        body << indent << "const Atom* " << result << " = " << constant(atom) << "->eval(env);\n";
+        return result;
+    }
+
+    std::string expression(const Atom* atom, std::ostream& body, const std::string& indent)
+    {
+        if(const Symbol* symbol = dynamic_cast<const Symbol*>(atom))
+        {
+            if(params_ != 0)
+            {
+                std::vector<std::string>::const_iterator found = std::find(params_->begin(), params_->end(), symbol->value());
+                if(found != params_->end())
+                {
+                    return "a[" + number(found - params_->begin()) + "]";
+                }
+            }
+            std::string result = temp();
+            body << indent << "const Atom* " << result << " = env.find(" << literal(symbol->value()) << ");\n";
+            return result;
+        }
+
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if(node == 0)
+        {
+            return constant(atom);
+        }
+        if(node == Node::getNull())
+        {
+            return "Node::getNull()";
+        }
+
+        std::vector<const Atom*> form = elements(node);
+        const Symbol* head = dynamic_cast<const Symbol*>(form[0]);
+        if(head == 0)
+        {
+            return fallback(atom, body, indent);
+        }
+
+        const std::string& name = head->value();
+        if(macros_.count(name) != 0)
+        {
+            return fallback(atom, body, indent);
+        }
+        if(((name == "define-macro") || (name == "define-syntax")) && (form.size() >= 2) && (typeid(*form[1]) == typeid(Symbol)))
+        {
+            macros_.insert(static_cast<const Symbol*>(form[1])->value());
+        }
+        if((name == "quote") && (form.size() >= 2))
+        {
+            return constant(form[1]);
+        }
+        if((name == "if") && (form.size() >= 4))
+        {
+            return branch(form, body, indent);
+        }
+        if(((name == "set!") || (name == "define")) && (form.size() >= 3) && (typeid(*form[1]) == typeid(Symbol)))
+        {
+            return bind(name == "set!", form, body, indent);
+        }
+        if((name == "lambda") && (form.size() >= 3) && dynamic_cast<const Node*>(form[1]) && dynamic_cast<const Node*>(form[2]))
+        {
+            return lambda(form, body, indent);
+        }
+        if((name == "begin") && (form.size() >= 2))
+        {
+            std::string result;
+            for(std::size_t i = 1; i < form.size(); ++i)
+            {
+                result = expression(form[i], body, indent);
+            }
+            return result;
+        }
+        if(special(name))
+        {
+            return fallback(atom, body, indent);
+        }
+
+        int primitive = (form.size() == 3) ? inlined(name) : -1;
+        if(primitive >= 0)
+        {
+            return operation(primitive, node, false, body, indent);
+        }
+        return call(node, body, indent);
+    }
+
+    // a C++ condition for the test of an if
+    std::string condition(const Atom* atom, std::ostream& body, const std::string& indent)
+    {
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if((node != 0) && (node != Node::getNull()) && (node->length() == 3) && (typeid(*node->car()) == typeid(Symbol)))
+        {
+            int primitive = inlined(static_cast<const Symbol*>(node->car())->value());
+            if((primitive >= 0) && (primitives[used_[primitive]].kind == Comparison))
+            {
+                return operation(primitive, node, true, body, indent);
+            }
+        }
+        return expression(atom, body, indent) + "->as<Bool>()->value()";
+    }
+
+    // how to test an operand for a fixnum and read it
+    void operand(const Atom* source, const std::string& value, std::string& check, std::string& result)
+    {
+        if(typeid(*source) == typeid(Integer))
+        {
+            result = fixnum(static_cast<const Integer*>(source)->value());
+            return;
+        }
+        check += (check.empty() ? "" : " && ") + ("(typeid(*" + value + ") == typeid(Integer))");
+        result = "static_cast<const Integer*>(" + value + ")->value()";
+    }
+
+    // An inlined primitive on two arguments; a comparison gives a C++
+    // bool when it is the test of an if.
+    std::string operation(int primitive, const Node* node, bool test, std::ostream& body, const std::string& indent)
+    {
+        const Primitive& p = primitives[used_[primitive]];
+        std::vector<const Atom*> form = elements(node);
+        std::string lhs = expression(form[1], body, indent);
+        std::string rhs = expression(form[2], body, indent);
+        std::string check, x, y;
+        operand(form[1], lhs, check, x);
+        operand(form[2], rhs, check, y);
+
+        std::string result = temp();
+        std::string fast;
+        body << indent << (test ? "bool " : "const Atom* ") << result << ";\n";
+        if(p.kind == Arithmetic)
+        {
+            std::string value = temp();
+            body << indent << "long long " << value << ";\n";
+            check += (check.empty() ? "" : " && ") + ("! " + std::string(p.op) + "(" + x + ", " + y + ", &" + value + ")");
+            fast = "new Integer(" + value + ")";
+        }
+        else if(p.kind == Division)
+        {
+            check += (check.empty() ? "" : " && ") + ("(" + y + " != 0) && ((" + y + " != -1) || (" + x + " != -0x7fffffffffffffffLL - 1))");
+            fast = "new Integer(" + x + " / " + y + ")";
+        }
+        else
+        {
+            fast = test ? x + " " + p.op + " " + y : "new Bool(" + x + " " + p.op + " " + y + ")";
+        }
+
+        std::string slow = "callPrimitive(" + number(primitive) + ", " + lhs + ", " + rhs + ", " + constant(node->cdr()) + ", env)";
+        if((p.kind == Division) && (y == "0LL"))
+        {
+            body << indent << result << " = " << slow << ";\n";
+            return result;
+        }
+        body << indent << "if(" << (check.empty() ? "true" : check) << ")\n" << indent << "{\n";
+        body << indent << "    " << result << " = " << fast << ";\n";
+        body << indent << "}\n" << indent << "else\n" << indent << "{\n";
+        body << indent << "    " << result << " = " << slow << (test ? "->as<Bool>()->value()" : "") << ";\n";
+        body << indent << "}\n";
+        return result;
+    }
+
+    std::string branch(const std::vector<const Atom*>& form, std::ostream& body, const std::string& indent)
+    {
+        std::string test   = condition(form[1], body, indent);
+        std::string result = temp();
+        body << indent << "const Atom* " << result << ";\n";
+        body << indent << "if(" << test << ")\n" << indent << "{\n";
+        std::string conseq = expression(form[2], body, indent + "    ");
+        body << indent << "    " << result << " = " << conseq << ";\n";
+        body << indent << "}\n" << indent << "else\n" << indent << "{\n";
+        std::string alt = expression(form[3], body, indent + "    ");
+        body << indent << "    " << result << " = " << alt << ";\n";
+        body << indent << "}\n";
+        return result;
+    }
+
+    std::string bind(bool set, const std::vector<const Atom*>& form, std::ostream& body, const std::string& indent)
+    {
+        std::string name  = literal(static_cast<const Symbol*>(form[1])->value());
+        std::string value = expression(form[2], body, indent);
+        if(set)
+        {
+            body << indent << "env.find(" << name << ");\n";
+        }
+        body << indent << "env.push(" << name << ", " << value << ");\n";
+        return value;
+    }
+
+    std::string lambda(const std::vector<const Atom*>& form, std::ostream& body, const std::string& indent)
+    {
+        std::string args = constant(form[1]);
+        std::string exp  = constant(form[2]);
+        std::string name = "Lambda" + number(lambdas_++);
+
+        std::vector<std::string> params;
+        bool local = localizable(static_cast<const Node*>(form[1]), form[2], params);
+
+        const std::vector<std::string>* outer      = params_;
+        std::string                     outerNames = paramNames_;
+        params_     = local ? &params : 0;
+        paramNames_ = "params" + name.substr(6);
+
+        std::ostringstream code;
+        std::string result = expression(form[2], code, "        ");
+
+        params_     = outer;
+        paramNames_ = outerNames;
+
+        if(local)
+        {
+            std::string values;
+            for(std::size_t i = 0; i < params.size(); ++i)
+            {
+                values += (i == 0) ? "" : ", ";
+                values += "frame.argument(" + number(i) + ")";
+            }
+            std::string lookups;
+            classes_ << "const char* const params" << name.substr(6) << "[] = { ";
+            for(std::size_t i = 0; i < params.size(); ++i)
+            {
+                classes_ << literal(params[i]) << ", ";
+                lookups += (i == 0) ? "" : ", ";
+                lookups += "env.find(" + literal(params[i]) + ")";
+            }
+            classes_ << "0 };\n\n";
+
+            classes_ << "class " << name << " : public Lambda\n{\npublic:\n";
+            classes_ << "    " << name << "(const Node* args, const Node* exp) : Lambda(args, exp)\n    {\n    }\n\n";
+            classes_ << "    const Atom* eval(Env& env) const\n    {\n";
+            classes_ << "        if( ! bound)\n        {\n            return Lambda::eval(env);\n        }\n";
+            classes_ << "        const Atom* a[] = { " << lookups << " };\n";
+            classes_ << "        return body(env, a);\n    }\n\n";
+            classes_ << "    const Atom* call(Frame& frame, const Node*) const\n    {\n";
+            classes_ << "        if(( ! bound) || (frame.arguments() != " << params.size() << "))\n        {\n            return frame.invoke();\n        }\n";
+            classes_ << "        const Atom* a[] = { " << values << " };\n";
+            classes_ << "        return body(frame.env(), a);\n    }\n\n";
+            classes_ << "private:\n";
+            classes_ << "    const Atom* body(Env& env, const Atom* const* a) const\n    {\n";
+        }
+        else
+        {
+            classes_ << "class " << name << " : public Lambda\n{\npublic:\n";
+            classes_ << "    " << name << "(const Node* args, const Node* exp) : Lambda(args, exp)\n    {\n    }\n\n";
+            classes_ << "    const Atom* eval(Env& env) const\n    {\n";
+            classes_ << "        if( ! bound)\n        {\n            return Lambda::eval(env);\n        }\n";
+        }
+        classes_ << code.str();
+        classes_ << "        return " << result << ";\n    }\n};\n\n";
+
+        std::string value = temp();
+        body << indent << "const Atom* " << value << " = new " << name << "(" << args << ", " << exp << ");\n";
+        return value;
+    }
+
+    std::string call(const Node* node, std::ostream& body, const std::string& indent)
+    {
+        std::vector<const Atom*> args = elements(node->cdr());
+        std::vector<std::string> rest;
+        for(Node::Iterator i(node->cdr()); ; ++i)
+        {
+            rest.push_back(constant(*i));
+            if( ! i.good())
+            {
+                break;
+            }
+        }
+
+        std::string result   = temp();
+        std::string function = "g" + number(temps_++);
+        std::string frame    = "f" + number(temps_++);
+        std::string scope    = "s" + number(temps_++);
+        body << indent << "const Atom* " << result << ";\n";
+        body << indent << "{\n";
+
+        std::string inner = indent + "    ";
+        std::string head = expression(node->car(), body, inner);
+        body << inner << "const Function* " << function << " = " << head << "->as<Function>();\n";
+        if(params_ != 0)
+        {
+            body << inner << "Scope " << scope << "(env, " << paramNames_ << ", a);\n";
+        }
+        body << inner << "Frame " << frame << "(" << function << ", env);\n";
+        for(std::size_t i = 0; i <= args.size(); ++i)
+        {
+            if(params_ != 0)
+            {
+                body << inner << "if(" << frame << ".variadic())\n" << inner << "{\n" << inner << "    " << scope << ".bind();\n" << inner << "}\n";
+            }
+            body << inner << "if(" << frame << ".accepts(" << rest[i] << "))\n" << inner << "{\n";
+            std::string value = (i < args.size()) ? expression(args[i], body, inner + "    ") : rest[i] + "->car()";
+            body << inner << "    " << frame << ".push(" << value << ");\n";
+            inner += "    ";
+        }
+        for(std::size_t i = 0; i <= args.size(); ++i)
+        {
+            inner.erase(inner.size() - 4);
+            body << inner << "}\n";
+        }
+        body << inner << result << " = " << function << "->call(" << frame << ", " << rest[0] << ");\n";
+        body << indent << "}\n";
+        return result;
+    }
+
+    std::ostream&      out_;
+    std::ostringstream init_;
+    std::ostringstream classes_;
+    std::ostringstream forms_;
+    std::set<std::string> macros_;      // names defined as macros so far; their uses are interpreted
+    std::set<std::string> free_;        // names other code may look up in the environment
+    std::set<std::string> rebound_;     // names bound anywhere but by appendFunctions
+    std::map<const Atom*, std::string> names_;
+    std::vector<int>   used_;           // the inlined primitives, as indices into primitives
+    const std::vector<std::string>* params_;    // parameters of the lambda being emitted, when held in locals
+    std::string        paramNames_;
+    int                constants_;
+    int                lists_;
+    int                lambdas_;
+    int                temps_;
+};
+
+const char* const Emitter::support =
+    "bool primitivesBound(Env& env)\n"
+    "{\n"
+    "    for(int i = 0; primitiveName[i] != 0; ++i)\n"
+    "    {\n"
+    "        if(env.lookup(primitiveName[i]) != primitive[i])\n"
+    "        {\n"
+    "            return false;\n"
+    "        }\n"
+    "    }\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "// the cases of an inlined primitive that are not written out\n"
+    "const Atom* callPrimitive(int i, const Atom* lhs, const Atom* rhs, const Node* site, Env& env)\n"
+    "{\n"
+    "    const Function* function = primitive[i]->as<Function>();\n"
+    "    Frame frame(function, env);\n"
+    "    frame.push(lhs);\n"
+    "    frame.push(rhs);\n"
+    "    return function->call(frame, site);\n"
+    "}\n"
+    "\n"
+    "// Binds the parameters a lambda holds in locals while a variadic\n"
+    "// primitive evaluates its arguments by name.\n"
+    "class Scope\n"
+    "{\n"
+    "public:\n"
+    "    Scope(Env& env, const char* const* names, const Atom* const* values) : env_(env), names_(names), values_(values), pushed_(0)\n"
+    "    {\n"
+    "    }\n"
+    "\n"
+    "    ~Scope()\n"
+    "    {\n"
+    "        for(; pushed_ > 0; --pushed_)\n"
+    "        {\n"
+    "            env_.pop();\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    void bind()\n"
+    "    {\n"
+    "        for(; names_[pushed_] != 0; ++pushed_)\n"
+    "        {\n"
+    "            env_.push(names_[pushed_], values_[pushed_]);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "private:\n"
+    "    Env&               env_;\n"
+    "    const char* const* names_;\n"
+    "    const Atom* const* values_;\n"
+    "    int                pushed_;\n"
+    "};\n"
+    "\n";
+
+} // end of anonymous namespace
+
+void emitCpp(const std::list<const Atom*>& program, const std::string& source, std::ostream& out)
+{
+    Emitter(out).emit(program, source);
+}
@@ -0,0 +1,12 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "atoms.h"
+
+#include <iosfwd>
+#include <list>
+#include <string>
+
+void emitCpp(const std::list<const Atom*>& program, const std::string& source, std::ostream& out);
+
+#endif//COMPILER_H
@@ -1,8 +1,20 @@
 #include "functions.h"
+#include "jit.h"
+#include "bignum.h"
+#include "binary.h"
+#include "hash.h"
+#include "persistent.h"
+#include "parser.h"
+#include "histogram.h"
 
+#include <algorithm>
+#include <fstream>
+#include <list>
 #include <string>
 #include <stdexcept>
 #include <functional>
+#include <typeinfo>
+#include <vector>
 
 namespace
 {
@@ -17,323 +29,1060 @@ const Node* creatArgList(const std::string& arg1, const std::string& arg2)
     return new Node(new Symbol(arg1), new Node(new Symbol(arg2), 0));
 }
 
+const Node* creatArgList(const std::string& arg1, const std::string& arg2, const std::string& arg3)
+{
+    return new Node(new Symbol(arg1), creatArgList(arg2, arg3));
+}
+
+std::size_t index(const Atom* atom)
+{
+    long long i = atom->as<Integer>()->value();
+    if(i < 0)
+    {
+        throw std::runtime_error("index out of range");
+    }
+    return i;
+}
+
+const Node* makeList(const std::vector<const Atom*>& atoms, const Node* tail)
+{
+    const Node* node = tail;
+    for(std::vector<const Atom*>::const_reverse_iterator i = atoms.rbegin(); i != atoms.rend(); ++i)
+    {
+        node = new Node(*i, node);
+    }
+    return node;
+}
+
+// calls a function with already evaluated arguments
+const Atom* apply(const Atom* function, const Atom* const* args, std::size_t n, Env& env)
+{
+    Frame frame(function->as<Function>(), env);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        if(frame.variadic())
+        {
+            frame.accepts(makeList(std::vector<const Atom*>(args + i, args + n), Node::getNull()));
+            break;
+        }
+        if( ! frame.accepts(0))
+        {
+            break;
+        }
+        frame.push(args[i]);
+    }
+    if(frame.accepts(Node::getNull()))
+    {
+        throw std::runtime_error("too few arguments");
+    }
+    return frame.invoke();
+}
+
+const Atom* apply(const Atom* function, const Atom* arg, Env& env)
+{
+    return apply(function, &arg, 1, env);
+}
+
+bool holds(const Atom* predicate, const Atom* arg, Env& env)
+{
+    return apply(predicate, arg, env)->as<Bool>()->value();
+}
+
+bool ordered(const Atom* less, const Atom* a, const Atom* b, Env& env)
+{
+    const Atom* args[] = { a, b };
+    return apply(less, args, 2, env)->as<Bool>()->value();
+}
+
+std::vector<const Atom*> elements(const Node* list)
+{
+    std::vector<const Atom*> atoms;
+    for(Node::Iterator i(list); i.good(); ++i)
+    {
+        atoms.push_back(i->car());
+    }
+    return atoms;
+}
+
+// bottom-up and stable: runs of width 1, 2, 4, ... are merged back and
+// forth between the elements and one buffer of the same size
+void mergeSort(std::vector<const Atom*>& atoms, const Atom* less, Env& env)
+{
+    const std::size_t n = atoms.size();
+    std::vector<const Atom*> buffer(n);
+    std::vector<const Atom*>* from = &atoms;
+    std::vector<const Atom*>* to   = &buffer;
+    for(std::size_t width = 1; width < n; width *= 2)
+    {
+        for(std::size_t lo = 0; lo < n; lo += 2 * width)
+        {
+            std::size_t mid = std::min(lo + width, n);
+            std::size_t hi  = std::min(lo + 2 * width, n);
+            std::size_t i = lo;
+            std::size_t j = mid;
+            std::size_t k = lo;
+            while((i < mid) && (j < hi))
+            {
+                (*to)[k++] = ordered(less, (*from)[j], (*from)[i], env) ? (*from)[j++] : (*from)[i++];
+            }
+            k = std::copy(from->begin() + i, from->begin() + mid, to->begin() + k) - to->begin();
+            std::copy(from->begin() + j, from->begin() + hi, to->begin() + k);
+        }
+        std::swap(from, to);
+    }
+    if(from != &atoms)
+    {
+        atoms.swap(buffer);
+    }
+}
+
 template<typename T> const Atom* newAtom(T);
-template<> const Atom* newAtom(int i)    { return new Integer(i); }
-template<> const Atom* newAtom(double r) { return new Real(r);    }
-template<> const Atom* newAtom(bool b)   { return new Bool(b);    }
+template<> const Atom* newAtom(BigInteger n) { return Bignum::create(n); }
+template<> const Atom* newAtom(double r)     { return new Real(r);       }
+template<> const Atom* newAtom(bool b)       { return new Bool(b);       }
+
+// sizes and counts; the few beyond the fixnum range become bignums
+const Atom* newCount(unsigned long long n)
+{
+    if(n <= 0x7fffffffffffffffULL)
+    {
+        return new Integer(static_cast<long long>(n));
+    }
+    return Bignum::create(BigInteger(static_cast<long long>(n >> 1)) * BigInteger(2) + BigInteger(static_cast<long long>(n & 1)));
+}
 
+// Exact arithmetic on fixnums and bignums. A fixnum operation gives 0
+// when its result overflows, and is then redone on bignums by
+// overflow(); bignum results that fit are demoted by Bignum::create.
 template<template<class> class OP>
-const Atom* operate(const Atom* lhs, const Atom* rhs)
+struct Exact
 {
-    const Real*    r1 = dynamic_cast<const Real*>(lhs);
-    const Real*    r2 = dynamic_cast<const Real*>(rhs);
-    const Integer* i1 = dynamic_cast<const Integer*>(lhs);
-    const Integer* i2 = dynamic_cast<const Integer*>(rhs);
+    const Atom* operator () (long long lhs, long long rhs) const
+    {
+        return newAtom(OP<long long>()(lhs, rhs));
+    }
 
-    if(i1 != 0)
+    const Atom* operator () (const BigInteger& lhs, const BigInteger& rhs) const
     {
-        if(i2 != 0)
+        return newAtom(OP<BigInteger>()(lhs, rhs));
+    }
+};
+
+template<>
+struct Exact<std::plus>
+{
+    const Atom* operator () (long long lhs, long long rhs) const
+    {
+        long long result;
+        return __builtin_add_overflow(lhs, rhs, &result) ? 0 : new Integer(result);
+    }
+
+    const Atom* operator () (const BigInteger& lhs, const BigInteger& rhs) const
+    {
+        return newAtom(lhs + rhs);
+    }
+};
+
+template<>
+struct Exact<std::minus>
+{
+    const Atom* operator () (long long lhs, long long rhs) const
+    {
+        long long result;
+        return __builtin_sub_overflow(lhs, rhs, &result) ? 0 : new Integer(result);
+    }
+
+    const Atom* operator () (const BigInteger& lhs, const BigInteger& rhs) const
+    {
+        return newAtom(lhs - rhs);
+    }
+};
+
+template<>
+struct Exact<std::multiplies>
+{
+    const Atom* operator () (long long lhs, long long rhs) const
+    {
+        long long result;
+        return __builtin_mul_overflow(lhs, rhs, &result) ? 0 : new Integer(result);
+    }
+
+    const Atom* operator () (const BigInteger& lhs, const BigInteger& rhs) const
+    {
+        return newAtom(lhs * rhs);
+    }
+};
+
+template<>
+struct Exact<std::divides>
+{
+    const Atom* operator () (long long lhs, long long rhs) const
+    {
+        if(rhs == 0)
         {
-            return newAtom(OP<int>()(i1->value(), i2->value()));
+            throw std::runtime_error("division by zero");
         }
-        else if(r2 != 0)
+        // the only quotient that overflows is LLONG_MIN / -1
+        if((rhs == -1) && (lhs == -0x7fffffffffffffffLL - 1))
         {
-            return newAtom(OP<double>()(i1->value(), r2->value()));
+            return 0;
         }
-        else
+        return new Integer(lhs / rhs);
+    }
+
+    const Atom* operator () (const BigInteger& lhs, const BigInteger& rhs) const
+    {
+        return newAtom(lhs / rhs);
+    }
+};
+
+template<template<class> class OP>
+__attribute__((noinline)) const Atom* overflow(long long lhs, long long rhs)
+{
+    return Exact<OP>()(BigInteger(lhs), BigInteger(rhs));
+}
+
+template<template<class> class OP>
+const Atom* fixnums(long long lhs, long long rhs)
+{
+    const Atom* result = Exact<OP>()(lhs, rhs);
+    return (result != 0) ? result : overflow<OP>(lhs, rhs);
+}
+
+// any number as a double, or 0 when the atom is not a number
+const Atom* inexact(const Atom* atom, double& value)
+{
+    if(const Integer* i = dynamic_cast<const Integer*>(atom))
+    {
+        value = static_cast<double>(i->value());
+    }
+    else if(const Real* r = dynamic_cast<const Real*>(atom))
+    {
+        value = r->value();
+    }
+    else if(const Bignum* n = dynamic_cast<const Bignum*>(atom))
+    {
+        value = n->value().toDouble();
+    }
+    else
+    {
+        return 0;
+    }
+    return atom;
+}
+
+BigInteger exact(const Atom* atom)
+{
+    if(const Integer* i = dynamic_cast<const Integer*>(atom))
+    {
+        return BigInteger(i->value());
+    }
+    return atom->as<Bignum>()->value();
+}
+
+template<template<class> class OP>
+const Atom* operate(const Atom* lhs, const Atom* rhs)
+{
+    const Integer* i1 = dynamic_cast<const Integer*>(lhs);
+    const Integer* i2 = dynamic_cast<const Integer*>(rhs);
+    if((i1 != 0) && (i2 != 0))
+    {
+        return fixnums<OP>(i1->value(), i2->value());
+    }
+
+    double d1, d2;
+    if(inexact(lhs, d1) == 0)
+    {
+        throw std::runtime_error("invalid 1st argument");
+    }
+    if(inexact(rhs, d2) == 0)
+    {
+        throw std::runtime_error("invalid 2nd argument");
+    }
+    if((typeid(*lhs) == typeid(Real)) || (typeid(*rhs) == typeid(Real)))
+    {
+        return newAtom(OP<double>()(d1, d2));
+    }
+    return Exact<OP>()(exact(lhs), exact(rhs));
+}
+
+// Type feedback is kept in the argument list of each call site: the
+// first observation picks a fast path, and a failed guard gives up on it.
+template<template<class> class OP>
+struct Operator
+{
+    enum Feedback { Unknown, IntegerInteger, RealReal, Polymorphic };
+
+    const Atom* operator () (const Atom* lhs, const Atom* rhs, const Node* site) const
+    {
+        const std::type_info& t1 = typeid(*lhs);
+        const std::type_info& t2 = typeid(*rhs);
+
+        switch(site->feedback())
         {
-            throw std::runtime_error("invalid 2nd argument");
+        case IntegerInteger:
+            if((t1 == typeid(Integer)) && (t2 == typeid(Integer)))
+            {
+                return fixnums<OP>(static_cast<const Integer*>(lhs)->value(), static_cast<const Integer*>(rhs)->value());
+            }
+            break;
+
+        case RealReal:
+            if((t1 == typeid(Real)) && (t2 == typeid(Real)))
+            {
+                return newAtom(OP<double>()(static_cast<const Real*>(lhs)->value(), static_cast<const Real*>(rhs)->value()));
+            }
+            break;
+
+        case Polymorphic:
+            return operate<OP>(lhs, rhs);
+
+        default:
+            break;
         }
+
+        site->feedback(record(site->feedback(), t1, t2));
+        return operate<OP>(lhs, rhs);
     }
-    else if(r1 != 0)
+
+    static Feedback record(int seen, const std::type_info& t1, const std::type_info& t2)
     {
-        if(i2 != 0)
+        if(seen != Unknown)                                       return Polymorphic;
+        if((t1 == typeid(Integer)) && (t2 == typeid(Integer)))   return IntegerInteger;
+        if((t1 == typeid(Real))    && (t2 == typeid(Real)))      return RealReal;
+        return Polymorphic;
+    }
+};
+
+// Called from a form, a numeric primitive takes its arguments straight
+// from the frame instead of binding and looking them up again.
+template<template<class> class OP>
+class Numeric : public Function
+{
+public:
+    Numeric() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return operate<OP>(env.find(" x"), env.find(" y"));
+    }
+
+    const Atom* call(Frame& frame, const Node* site) const
+    {
+        if(frame.arguments() < 2)
         {
-            return newAtom(OP<double>()(r1->value(), i2->value()));
+            return frame.invoke();
         }
-        else if(r2 != 0)
+        return Operator<OP>()(frame.argument(0), frame.argument(1), site);
+    }
+};
+
+typedef Numeric<std::plus>            Plus;
+typedef Numeric<std::minus>           Minus;
+typedef Numeric<std::multiplies>      Multiplies;
+typedef Numeric<std::divides>         Divides;
+typedef Numeric<std::greater>         Greater;
+typedef Numeric<std::less>            Less;
+typedef Numeric<std::greater_equal>   GreaterEqual;
+typedef Numeric<std::less_equal>      LessEqual;
+typedef Numeric<std::equal_to>        Equal;
+
+class Not : public Function
+{
+public:
+    Not() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Bool* operand = env.find(" x")->eval(env)->as<Bool>();
+        return new Bool(! operand->value());
+    }
+};
+
+class Length : public Function
+{
+public:
+    Length() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return new Integer(env.find(" x")->as<Node>()->length());
+    }
+};
+
+class Cons : public Function
+{
+public:
+    Cons() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* car = env.find(" x");
+        const Node* cdr = env.find(" y")->as<Node>();
+        return new Node(car, cdr);
+    }
+};
+
+class Car : public Function
+{
+public:
+    Car() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return env.find(" x")->as<Node>()->car();
+    }
+};
+
+class Cdr : public Function
+{
+public:
+    Cdr() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return env.find(" x")->as<Node>()->cdr();
+    }
+};
+
+class Append : public Function
+{
+public:
+    Append() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Node* lhs = env.find(" x")->as<Node>();
+        const Node* rhs = env.find(" y")->as<Node>();
+        std::vector<const Atom*> atoms;
+        atoms.reserve(lhs->length());
+        for(Node::Iterator i(lhs); i.good(); ++i)
         {
-            return newAtom(OP<double>()(r1->value(), r2->value()));
+            atoms.push_back(i->car());
         }
-        else
+        return makeList(atoms, rhs);
+    }
+};
+
+class List : public Function
+{
+public:
+    List() : Function(creatArgList(" ")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Node* args = env.find(" ")->as<Node>();
+        std::vector<const Atom*> atoms;
+        atoms.reserve(args->length());
+        for(Node::Iterator i(args); i.good(); ++i)
         {
-            throw std::runtime_error("invalid 2nd argument");
+            atoms.push_back(i->car()->eval(env));
         }
+        return makeList(atoms, Node::getNull());
     }
-    else
+};
+
+class IsList : public Function
+{
+public:
+    IsList() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
     {
-        throw std::runtime_error("invalid 1st argument");
+        const Node* x = dynamic_cast<const Node*>(env.find(" x"));
+        return new Bool(x != 0);
     }
-}
+};
 
-class Plus : public Function
+class IsNull : public Function
 {
 public:
-    Plus() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    IsNull() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::plus>(lhs, rhs);
+        const Atom* atom = env.find(" x");
+        return new Bool((atom == 0) || (atom == Node::getNull()));
     }
 };
 
-class Minus : public Function
+class IsSymbol : public Function
 {
 public:
-    Minus() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    IsSymbol() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::minus>(lhs, rhs);
+        const Symbol* x = dynamic_cast<const Symbol*>(env.find(" x")->eval(env));
+        return new Bool(x != 0);
     }
 };
 
-class Multiplies : public Function
+class WriteBinary : public Function
 {
 public:
-    Multiplies() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    WriteBinary() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::multiplies>(lhs, rhs);
+        const Symbol* path = env.find(" x")->as<Symbol>();
+        return newCount(writeBinary(path->value(), env.find(" y")));
     }
 };
 
-class Divides : public Function
+class ReadBinary : public Function
 {
 public:
-    Divides() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    ReadBinary() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::divides>(lhs, rhs);
+        return readBinary(env.find(" x")->as<Symbol>()->value());
     }
 };
 
-class Not : public Function
+class MakeHash : public Function
 {
 public:
-    Not() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    MakeHash() : Function(Node::getNull()) { pool_.push_back(this); }
+
+    const Atom* eval(Env&) const
+    {
+        return new HashTable;
+    }
+};
+
+class HashRef : public Function
+{
+public:
+    HashRef() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Bool* operand = env.find(" x")->eval(env)->as<Bool>();
-        return new Bool(! operand->value());
+        const Atom* value = env.find(" x")->as<HashTable>()->find(env.find(" y"));
+        return (value != 0) ? value : env.find(" z");
     }
 };
 
-class Greater : public Function
+class HashSet : public Function
 {
 public:
-    Greater() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    HashSet() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::greater>(lhs, rhs);
+        const Atom* value = env.find(" z");
+        env.find(" x")->as<HashTable>()->set(env.find(" y"), value);
+        return value;
     }
 };
 
-class Less : public Function
+class HashRemove : public Function
 {
 public:
-    Less() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    HashRemove() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::less>(lhs, rhs);
+        return new Bool(env.find(" x")->as<HashTable>()->remove(env.find(" y")));
     }
 };
 
-class GreaterEqual : public Function
+class HashCount : public Function
 {
 public:
-    GreaterEqual() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    HashCount() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::greater_equal>(lhs, rhs);
+        return newCount(env.find(" x")->as<HashTable>()->size());
     }
 };
 
-class LessEqual : public Function
+class MakeVector : public Function
 {
 public:
-    LessEqual() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    MakeVector() : Function(creatArgList(" ")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::less_equal>(lhs, rhs);
+        std::vector<const Atom*> atoms;
+        for(Node::Iterator i(env.find(" ")->as<Node>()); i.good(); ++i)
+        {
+            atoms.push_back(i->car()->eval(env));
+        }
+        return Vector::create(atoms);
     }
 };
 
-class Equal : public Function
+class ListToVector : public Function
 {
 public:
-    Equal() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    ListToVector() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* lhs = env.find(" x")->eval(env);
-        const Atom* rhs = env.find(" y")->eval(env);
-        return operate<std::equal_to>(lhs, rhs);
+        std::vector<const Atom*> atoms;
+        for(Node::Iterator i(env.find(" x")->as<Node>()); i.good(); ++i)
+        {
+            atoms.push_back(i->car());
+        }
+        return Vector::create(atoms);
     }
 };
 
-class Length : public Function
+class VectorToList : public Function
 {
 public:
-    Length() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    VectorToList() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        Node::Iterator n(env.find(" x")->eval(env)->as<Node>());
-        int i = 0;
-        while(n.good())
+        const Vector* v = env.find(" x")->as<Vector>();
+        std::vector<const Atom*> atoms;
+        atoms.reserve(v->size());
+        for(std::size_t i = 0; i < v->size(); ++i)
         {
-            ++i;
-            ++n;
+            atoms.push_back(v->ref(i));
         }
-        return new Integer(i);
+        return makeList(atoms, Node::getNull());
     }
 };
 
-class Cons : public Function
+class VectorRef : public Function
 {
 public:
-    Cons() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    VectorRef() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* car = env.find(" x");
-        const Node* cdr = env.find(" y")->as<Node>();
-        return new Node(car, cdr);
+        return env.find(" x")->as<Vector>()->ref(index(env.find(" y")));
     }
 };
 
-class Car : public Function
+class VectorSet : public Function
 {
 public:
-    Car() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    VectorSet() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        return env.find(" x")->as<Node>()->car();
+        return env.find(" x")->as<Vector>()->set(index(env.find(" y")), env.find(" z"));
     }
 };
 
-class Cdr : public Function
+class VectorPush : public Function
 {
 public:
-    Cdr() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    VectorPush() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        return env.find(" x")->as<Node>()->cdr();
+        return env.find(" x")->as<Vector>()->push(env.find(" y"));
     }
 };
 
-class Append : public Function
+class VectorLength : public Function
 {
 public:
-    Append() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+    VectorLength() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return newCount(env.find(" x")->as<Vector>()->size());
+    }
+};
+
+class MakeMap : public Function
+{
+public:
+    MakeMap() : Function(Node::getNull()) { pool_.push_back(this); }
+
+    const Atom* eval(Env&) const
+    {
+        return new Map;
+    }
+};
+
+class MapRef : public Function
+{
+public:
+    MapRef() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* value = env.find(" x")->as<Map>()->find(env.find(" y"));
+        return (value != 0) ? value : env.find(" z");
+    }
+};
+
+class MapSet : public Function
+{
+public:
+    MapSet() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return env.find(" x")->as<Map>()->set(env.find(" y"), env.find(" z"));
+    }
+};
+
+class MapRemove : public Function
+{
+public:
+    MapRemove() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Node* lhs = env.find(" x")->eval(env)->as<Node>();
-        const Node* rhs = env.find(" y")->eval(env)->as<Node>();
-        return new Node(lhs->car(), append(lhs->cdr(), rhs));
+        return env.find(" x")->as<Map>()->remove(env.find(" y"));
+    }
+};
+
+class MapCount : public Function
+{
+public:
+    MapCount() : Function(creatArgList(" x")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return newCount(env.find(" x")->as<Map>()->size());
+    }
+};
+
+// ((parse count p50 p99 p999 max) (eval ...)), latencies in microseconds
+class LatencyStatsReport : public Function
+{
+public:
+    LatencyStatsReport() : Function(Node::getNull()) { pool_.push_back(this); }
+
+    const Atom* eval(Env&) const
+    {
+        return new Node(summary("parse", LatencyStats::parse()), new Node(summary("eval", LatencyStats::eval()), Node::getNull()));
     }
 
 private:
-    const Node* append(const Node* lhs, const Node* rhs) const
+    static const Node* summary(const std::string& name, const Histogram& histogram)
     {
-        if(lhs->cdr() == 0)
+        const Node* result = new Node(new Real(histogram.max() / 1e3), Node::getNull());
+        result = new Node(new Real(histogram.percentile(99.9) / 1e3), result);
+        result = new Node(new Real(histogram.percentile(99) / 1e3), result);
+        result = new Node(new Real(histogram.percentile(50) / 1e3), result);
+        result = new Node(newCount(histogram.count()), result);
+        return new Node(new Symbol(name), result);
+    }
+};
+
+class MapList : public Function
+{
+public:
+    MapList() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* function = env.find(" x");
+        std::vector<const Atom*> atoms;
+        for(Node::Iterator i(env.find(" y")->as<Node>()); i.good(); ++i)
         {
-            return new Node(lhs->car(), rhs);
+            atoms.push_back(apply(function, i->car(), env));
         }
-        else
+        return makeList(atoms, Node::getNull());
+    }
+};
+
+class ForEach : public Function
+{
+public:
+    ForEach() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* function = env.find(" x");
+        for(Node::Iterator i(env.find(" y")->as<Node>()); i.good(); ++i)
         {
-            return new Node(lhs->car(), append(lhs->cdr(), rhs));
+            apply(function, i->car(), env);
         }
+        return Node::getNull();
     }
 };
 
-class List : public Function
+class Filter : public Function
 {
 public:
-    List() : Function(creatArgList(" ")) { pool_.push_back(this); }
+    Filter() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* predicate = env.find(" x");
+        std::vector<const Atom*> atoms;
+        for(Node::Iterator i(env.find(" y")->as<Node>()); i.good(); ++i)
+        {
+            if(holds(predicate, i->car(), env))
+            {
+                atoms.push_back(i->car());
+            }
+        }
+        return makeList(atoms, Node::getNull());
+    }
+};
+
+// (reduce f initial list) folds from the left: (f (f initial x1) x2) ...
+class Reduce : public Function
+{
+public:
+    Reduce() : Function(creatArgList(" x", " y", " z")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Atom* function = env.find(" x");
+        const Atom* args[]   = { env.find(" y"), 0 };
+        for(Node::Iterator i(env.find(" z")->as<Node>()); i.good(); ++i)
+        {
+            args[1] = i->car();
+            args[0] = apply(function, args, 2, env);
+        }
+        return args[0];
+    }
+};
+
+// (sort list less?)
+class Sort : public Function
+{
+public:
+    Sort() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        return eval_(env.find(" ")->as<Node>(), env);
+        std::vector<const Atom*> atoms = elements(env.find(" x")->as<Node>());
+        mergeSort(atoms, env.find(" y"), env);
+        return makeList(atoms, Node::getNull());
+    }
+};
+
+const Node* streamCell(const Atom* car, const Promise* cdr)
+{
+    return new Node(car, new Node(cdr, Node::getNull()));
+}
+
+const Node* streamCdr(const Node* stream, Env& env)
+{
+    return stream->cdr()->car()->as<Promise>()->force(env)->as<Node>();
+}
+
+const Node* streamMap(const Atom* function, const Node* stream, Env& env);
+const Node* streamFilter(const Atom* predicate, const Node* stream, Env& env);
+
+class StreamMapPromise : public Promise
+{
+public:
+    StreamMapPromise(const Atom* function, const Node* stream) : function_(function), stream_(stream) {}
+
+protected:
+    const Atom* compute(Env& env) const
+    {
+        return streamMap(function_, streamCdr(stream_, env), env);
     }
 
 private:
-    const Node* eval_(const Node* node, Env& env) const
+    const Atom* function_;
+    const Node* stream_;
+};
+
+class StreamFilterPromise : public Promise
+{
+public:
+    StreamFilterPromise(const Atom* predicate, const Node* stream) : predicate_(predicate), stream_(stream) {}
+
+protected:
+    const Atom* compute(Env& env) const
+    {
+        return streamFilter(predicate_, streamCdr(stream_, env), env);
+    }
+
+private:
+    const Atom* predicate_;
+    const Node* stream_;
+};
+
+const Node* streamMap(const Atom* function, const Node* stream, Env& env)
+{
+    if(stream == Node::getNull())
+    {
+        return stream;
+    }
+    return streamCell(apply(function, stream->car(), env), new StreamMapPromise(function, stream));
+}
+
+const Node* streamFilter(const Atom* predicate, const Node* stream, Env& env)
+{
+    while((stream != Node::getNull()) && ! apply(predicate, stream->car(), env)->as<Bool>()->value())
+    {
+        stream = streamCdr(stream, env);
+    }
+    if(stream == Node::getNull())
+    {
+        return stream;
+    }
+    return streamCell(stream->car(), new StreamFilterPromise(predicate, stream));
+}
+
+// An open file shared by the promises of one read-lines/read-forms stream.
+class LineSource : public Atom
+{
+public:
+    LineSource(const std::string& path, bool forms) : file_(path.c_str()), forms_(forms)
+    {
+        if( ! file_)
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+        pool_.push_back(this);
+    }
+
+    void write(std::ostream& out) const { out << "line source"; }
+    const Atom* eval(Env&) const { return this; }
+
+    const Node* next() const
     {
-        if(node == Node::getNull())
+        std::string line;
+        if( ! forms_)
+        {
+            return std::getline(file_, line) ? streamCell(new Symbol(line), new NextLine(this)) : Node::getNull();
+        }
+
+        // a line may hold several forms; they are handed out one per cell
+        std::string text;
+        while(queued_.empty() && std::getline(file_, line))
+        {
+            text += line + "\n";
+            if(unbalanced(text) || (text.find_first_not_of(" \t\r\n") == std::string::npos))
+            {
+                continue;
+            }
+            queued_ = parseAll(text);
+            text.clear();
+        }
+        // a form left open at the end of the file fails as in the parser
+        if(queued_.empty() && (text.find_first_not_of(" \t\r\n") != std::string::npos))
+        {
+            queued_ = parseAll(text);
+        }
+        if(queued_.empty())
         {
-            return node;
+            return Node::getNull();
         }
-        else
+        const Atom* form = queued_.front();
+        queued_.pop_front();
+        return streamCell(form, new NextLine(this));
+    }
+
+private:
+    class NextLine : public Promise
+    {
+    public:
+        NextLine(const LineSource* source) : source_(source) {}
+
+    protected:
+        const Atom* compute(Env&) const { return source_->next(); }
+
+    private:
+        const LineSource* source_;
+    };
+
+    static bool unbalanced(const std::string& text)
+    {
+        int depth = 0;
+        for(std::string::const_iterator i = text.begin(); i != text.end(); ++i)
         {
-            return new Node(node->car()->eval(env), eval_(node->cdr(), env));
+            depth += (*i == '(') ? 1 : (*i == ')') ? -1 : 0;
         }
+        return depth > 0;
     }
+
+    mutable std::ifstream          file_;
+    const bool                     forms_;
+    mutable std::list<const Atom*> queued_;
 };
 
-class IsList : public Function
+class StreamCar : public Function
 {
 public:
-    IsList() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    StreamCar() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Node* x = dynamic_cast<const Node*>(env.find(" x"));
-        return new Bool(x != 0);
+        return env.find(" x")->as<Node>()->car();
     }
 };
 
-class IsNull : public Function
+class StreamCdr : public Function
 {
 public:
-    IsNull() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    StreamCdr() : Function(creatArgList(" x")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Atom* atom = env.find(" x");
-        return new Bool((atom == 0) || (atom == Node::getNull()));
+        return streamCdr(env.find(" x")->as<Node>(), env);
     }
 };
 
-class IsSymbol : public Function
+class StreamMap : public Function
 {
 public:
-    IsSymbol() : Function(creatArgList(" x")) { pool_.push_back(this); }
+    StreamMap() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
 
     const Atom* eval(Env& env) const
     {
-        const Symbol* x = dynamic_cast<const Symbol*>(env.find(" x")->eval(env));
-        return new Bool(x != 0);
+        return streamMap(env.find(" x"), env.find(" y")->as<Node>(), env);
     }
 };
 
+class StreamFilter : public Function
+{
+public:
+    StreamFilter() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return streamFilter(env.find(" x"), env.find(" y")->as<Node>(), env);
+    }
+};
+
+class StreamTake : public Function
+{
+public:
+    StreamTake() : Function(creatArgList(" x", " y")) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        const Node* stream = env.find(" x")->as<Node>();
+        long long n = env.find(" y")->as<Integer>()->value();
+        std::vector<const Atom*> atoms;
+        for(long long i = 0; (i < n) && (stream != Node::getNull()); ++i)
+        {
+            atoms.push_back(stream->car());
+            if(i + 1 < n)
+            {
+                stream = streamCdr(stream, env);
+            }
+        }
+        return makeList(atoms, Node::getNull());
+    }
+};
+
+class ReadLines : public Function
+{
+public:
+    ReadLines(bool forms) : Function(creatArgList(" x")), forms_(forms) { pool_.push_back(this); }
+
+    const Atom* eval(Env& env) const
+    {
+        return (new LineSource(env.find(" x")->as<Symbol>()->value(), forms_))->next();
+    }
+
+private:
+    const bool forms_;
+};
+
 } // end of anonymous namespace
 
 void appendFunctions(Env& env)
@@ -358,4 +1107,46 @@ void appendFunctions(Env& env)
     env.push("list?",   new IsList);
     env.push("null?",   new IsNull);
     env.push("symbol?", new IsSymbol);
+    env.push("write-binary", new WriteBinary);
+    env.push("read-binary",  new ReadBinary);
+    env.push("make-hash",    new MakeHash);
+    env.push("hash-ref",     new HashRef);
+    env.push("hash-set!",    new HashSet);
+    env.push("hash-remove!", new HashRemove);
+    env.push("hash-count",   new HashCount);
+    env.push("vector",        new MakeVector);
+    env.push("list->vector",  new ListToVector);
+    env.push("vector->list",  new VectorToList);
+    env.push("vector-ref",    new VectorRef);
+    env.push("vector-set",    new VectorSet);
+    env.push("vector-push",   new VectorPush);
+    env.push("vector-length", new VectorLength);
+    env.push("make-map",      new MakeMap);
+    env.push("map-ref",       new MapRef);
+    env.push("map-set",       new MapSet);
+    env.push("map-remove",    new MapRemove);
+    env.push("map-count",     new MapCount);
+    env.push("stream-car",    new StreamCar);
+    env.push("stream-cdr",    new StreamCdr);
+    env.push("stream-map",    new StreamMap);
+    env.push("stream-filter", new StreamFilter);
+    env.push("stream-take",   new StreamTake);
+    env.push("read-lines",    new ReadLines(false));
+    env.push("read-forms",    new ReadLines(true));
+    env.push("latency-stats", new LatencyStatsReport);
+    env.push("map",           new MapList);
+    env.push("for-each",      new ForEach);
+    env.push("filter",        new Filter);
+    env.push("reduce",        new Reduce);
+    env.push("sort",          new Sort);
+
+    NativeCode::intrinsic(env.find("+"),  NativeCode::Add);
+    NativeCode::intrinsic(env.find("-"),  NativeCode::Subtract);
+    NativeCode::intrinsic(env.find("*"),  NativeCode::Multiply);
+    NativeCode::intrinsic(env.find("/"),  NativeCode::Divide);
+    NativeCode::intrinsic(env.find("<"),  NativeCode::Less);
+    NativeCode::intrinsic(env.find(">"),  NativeCode::Greater);
+    NativeCode::intrinsic(env.find("<="), NativeCode::LessEqual);
+    NativeCode::intrinsic(env.find(">="), NativeCode::GreaterEqual);
+    NativeCode::intrinsic(env.find("="),  NativeCode::Equal);
 }
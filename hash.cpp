@@ -0,0 +1,246 @@
+#include "hash.h"
+#include "bignum.h"
+
+#include <cstring>
+#include <ostream>
+#include <typeinfo>
+
+namespace
+{
+
+std::size_t mix(unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<std::size_t>(h);
+}
+
+std::size_t combine(std::size_t seed, std::size_t h)
+{
+    return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+} // end of anonymous namespace
+
+// Numbers, symbols and booleans hash by value and lists by structure;
+// everything else (functions, tables) hashes by identity.
+std::size_t hashAtom(const Atom* atom)
+{
+    if(const Integer* i = dynamic_cast<const Integer*>(atom))
+    {
+        return mix(static_cast<unsigned long long>(i->value()));
+    }
+    if(const Bignum* n = dynamic_cast<const Bignum*>(atom))
+    {
+        std::size_t h = mix(n->value().negative() ? 0x3c6ef372 : 0x0a54ff53);
+        const BigInteger::Limbs& limbs = n->value().limbs();
+        for(BigInteger::Limbs::const_iterator i = limbs.begin(); i != limbs.end(); ++i)
+        {
+            h = combine(h, mix(*i));
+        }
+        return h;
+    }
+    if(const Real* r = dynamic_cast<const Real*>(atom))
+    {
+        double value = (r->value() == 0) ? 0 : r->value();
+        unsigned long long bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return mix(bits ^ 0x5bd1e995);
+    }
+    if(const Bool* b = dynamic_cast<const Bool*>(atom))
+    {
+        return mix(b->value() ? 0x1f3d5b79 : 0x2e4c6a88);
+    }
+    if(const Symbol* s = dynamic_cast<const Symbol*>(atom))
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for(std::string::const_iterator i = s->value().begin(); i != s->value().end(); ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(*i)) * 1099511628211ULL;
+        }
+        return mix(h);
+    }
+    if(const Node* node = dynamic_cast<const Node*>(atom))
+    {
+        std::size_t h = mix(node->length());
+        for(Node::Iterator i(node); i.good(); ++i)
+        {
+            h = combine(h, hashAtom(i->car()));
+        }
+        return h;
+    }
+    return mix(reinterpret_cast<unsigned long long>(atom));
+}
+
+bool equalAtoms(const Atom* lhs, const Atom* rhs)
+{
+    if(lhs == rhs)
+    {
+        return true;
+    }
+    if(typeid(*lhs) != typeid(*rhs))
+    {
+        return false;
+    }
+    if(const Integer* i = dynamic_cast<const Integer*>(lhs))
+    {
+        return i->value() == static_cast<const Integer*>(rhs)->value();
+    }
+    if(const Bignum* n = dynamic_cast<const Bignum*>(lhs))
+    {
+        return n->value() == static_cast<const Bignum*>(rhs)->value();
+    }
+    if(const Real* r = dynamic_cast<const Real*>(lhs))
+    {
+        return r->value() == static_cast<const Real*>(rhs)->value();
+    }
+    if(const Bool* b = dynamic_cast<const Bool*>(lhs))
+    {
+        return b->value() == static_cast<const Bool*>(rhs)->value();
+    }
+    if(const Symbol* s = dynamic_cast<const Symbol*>(lhs))
+    {
+        return s->value() == static_cast<const Symbol*>(rhs)->value();
+    }
+    if(const Node* node = dynamic_cast<const Node*>(lhs))
+    {
+        const Node* other = static_cast<const Node*>(rhs);
+        if(node->length() != other->length())
+        {
+            return false;
+        }
+        for(Node::Iterator i(node), j(other); i.good(); ++i, ++j)
+        {
+            if( ! equalAtoms(i->car(), j->car()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+HashTable::HashTable() : slots_(8), size_(0), used_(0)
+{
+    pool_.push_back(this);
+}
+
+void HashTable::write(std::ostream& out) const
+{
+    out << "hash " << size_;
+}
+
+const HashTable* HashTable::eval(Env& env) const
+{
+    return this;
+}
+
+const Atom* HashTable::find(const Atom* key) const
+{
+    const Slot& slot = slots_[probe(key, hashAtom(key))];
+    return (slot.state == Full) ? slot.value : 0;
+}
+
+void HashTable::set(const Atom* key, const Atom* value) const
+{
+    if((used_ + 1) * 2 > slots_.size())
+    {
+        rehash((size_ + 1) * 4 > slots_.size() ? slots_.size() * 2 : slots_.size());
+    }
+
+    std::size_t hash = hashAtom(key);
+    Slot& slot = slots_[probe(key, hash)];
+    if(slot.state != Full)
+    {
+        if(slot.state == Empty)
+        {
+            ++used_;
+        }
+        ++size_;
+        slot.state = Full;
+        slot.hash  = hash;
+        slot.key   = key;
+    }
+    slot.value = value;
+}
+
+bool HashTable::remove(const Atom* key) const
+{
+    Slot& slot = slots_[probe(key, hashAtom(key))];
+    if(slot.state != Full)
+    {
+        return false;
+    }
+    slot.state = Deleted;
+    slot.key   = 0;
+    slot.value = 0;
+    --size_;
+    return true;
+}
+
+std::size_t HashTable::size() const
+{
+    return size_;
+}
+
+void HashTable::pairs(Pairs& out) const
+{
+    for(std::vector<Slot>::const_iterator i = slots_.begin(); i != slots_.end(); ++i)
+    {
+        if(i->state == Full)
+        {
+            out.push_back(std::make_pair(i->key, i->value));
+        }
+    }
+}
+
+// Linear probing. Returns the slot holding the key or, when it is
+// missing, the first reusable slot on its probe sequence.
+std::size_t HashTable::probe(const Atom* key, std::size_t hash) const
+{
+    std::size_t mask    = slots_.size() - 1;
+    std::size_t deleted = slots_.size();
+    for(std::size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& slot = slots_[i];
+        if(slot.state == Empty)
+        {
+            return (deleted != slots_.size()) ? deleted : i;
+        }
+        if(slot.state == Deleted)
+        {
+            if(deleted == slots_.size())
+            {
+                deleted = i;
+            }
+        }
+        else if((slot.hash == hash) && equalAtoms(slot.key, key))
+        {
+            return i;
+        }
+    }
+}
+
+void HashTable::rehash(std::size_t capacity) const
+{
+    std::vector<Slot> slots(capacity);
+    slots.swap(slots_);
+    used_ = size_;
+    for(std::vector<Slot>::const_iterator i = slots.begin(); i != slots.end(); ++i)
+    {
+        if(i->state == Full)
+        {
+            std::size_t mask = slots_.size() - 1;
+            std::size_t j    = i->hash & mask;
+            while(slots_[j].state != Empty)
+            {
+                j = (j + 1) & mask;
+            }
+            slots_[j] = *i;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "atoms.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+std::size_t hashAtom(const Atom* atom);
+bool equalAtoms(const Atom* lhs, const Atom* rhs);
+
+class HashTable : public Atom
+{
+public:
+    typedef std::vector<std::pair<const Atom*, const Atom*> > Pairs;
+
+    HashTable();
+    void write(std::ostream& out) const;
+    const HashTable* eval(Env& env) const;
+    const Atom* find(const Atom* key) const;
+    void set(const Atom* key, const Atom* value) const;
+    bool remove(const Atom* key) const;
+    std::size_t size() const;
+    void pairs(Pairs& out) const;
+
+private:
+    enum State { Empty, Full, Deleted };
+
+    struct Slot
+    {
+        Slot() : state(Empty), hash(0), key(0), value(0) {}
+
+        State       state;
+        std::size_t hash;
+        const Atom* key;
+        const Atom* value;
+    };
+
+    std::size_t probe(const Atom* key, std::size_t hash) const;
+    void rehash(std::size_t capacity) const;
+
+    mutable std::vector<Slot> slots_;
+    mutable std::size_t       size_;
+    mutable std::size_t       used_;
+};
+
+#endif//HASH_H
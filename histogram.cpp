@@ -0,0 +1,156 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <ostream>
+
+namespace
+{
+
+const int                SubBucketBits = 7;
+const unsigned long long SubBuckets    = 1ULL << SubBucketBits;
+const unsigned long long HalfBuckets   = SubBuckets / 2;
+const std::size_t        Buckets       = (64 - SubBucketBits + 1) * HalfBuckets + HalfBuckets;
+
+} // end of anonymous namespace
+
+Histogram::Histogram() : counts_(Buckets, 0), count_(0), max_(0)
+{
+}
+
+void Histogram::record(unsigned long long value)
+{
+    ++counts_[bucket(value)];
+    ++count_;
+    max_ = std::max(max_, value);
+}
+
+void Histogram::reset()
+{
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    max_   = 0;
+}
+
+unsigned long long Histogram::count() const
+{
+    return count_;
+}
+
+unsigned long long Histogram::max() const
+{
+    return max_;
+}
+
+unsigned long long Histogram::percentile(double p) const
+{
+    if(count_ == 0)
+    {
+        return 0;
+    }
+
+    unsigned long long rank = static_cast<unsigned long long>(p / 100 * count_ + 0.5);
+    rank = std::max(1ULL, std::min(rank, count_));
+    unsigned long long seen = 0;
+    for(std::size_t i = 0; i < counts_.size(); ++i)
+    {
+        seen += counts_[i];
+        if(seen >= rank)
+        {
+            return std::min(highest(i), max_);
+        }
+    }
+    return max_;
+}
+
+// Values below SubBuckets get a bucket each. Above that, a value whose
+// highest bit is h keeps its top SubBucketBits bits, which lie in
+// [HalfBuckets, SubBuckets), and the shift h - SubBucketBits + 1 selects
+// the group of HalfBuckets buckets.
+std::size_t Histogram::bucket(unsigned long long value)
+{
+    if(value < SubBuckets)
+    {
+        return static_cast<std::size_t>(value);
+    }
+    int shift = (63 - __builtin_clzll(value)) - SubBucketBits + 1;
+    return static_cast<std::size_t>(shift * HalfBuckets + (value >> shift));
+}
+
+unsigned long long Histogram::highest(std::size_t bucket)
+{
+    if(bucket < SubBuckets)
+    {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket / HalfBuckets) - 1;
+    unsigned long long sub = bucket % HalfBuckets + HalfBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+unsigned long long nanoseconds()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+bool      LatencyStats::enabled_ = false;
+double    LatencyStats::slowMs_  = 0;
+Histogram LatencyStats::parse_;
+Histogram LatencyStats::eval_;
+
+void LatencyStats::enable()
+{
+    enabled_ = true;
+}
+
+void LatencyStats::logSlowForms(double ms)
+{
+    enabled_ = true;
+    slowMs_  = ms;
+}
+
+bool LatencyStats::enabled()
+{
+    return enabled_;
+}
+
+void LatencyStats::record(const std::string& source, unsigned long long parseNs, unsigned long long evalNs,
+                          std::size_t parseAllocations, std::size_t evalAllocations)
+{
+    parse_.record(parseNs);
+    eval_.record(evalNs);
+
+    if((slowMs_ > 0) && ((parseNs + evalNs) / 1e6 >= slowMs_))
+    {
+        std::fprintf(stderr, "slow form: %.3fms (parse %.3fms, %lu allocations; eval %.3fms, %lu allocations): %s\n",
+                     (parseNs + evalNs) / 1e6, parseNs / 1e6, static_cast<unsigned long>(parseAllocations),
+                     evalNs / 1e6, static_cast<unsigned long>(evalAllocations), source.c_str());
+    }
+}
+
+const Histogram& LatencyStats::parse()
+{
+    return parse_;
+}
+
+const Histogram& LatencyStats::eval()
+{
+    return eval_;
+}
+
+void LatencyStats::report(std::ostream& out)
+{
+    const char*      names[]      = { "parse", "eval" };
+    const Histogram* histograms[] = { &parse_, &eval_ };
+    for(int i = 0; i < 2; ++i)
+    {
+        char buffer[160];
+        std::sprintf(buffer, "%-5s %8llu forms  p50 %.1fus  p99 %.1fus  p999 %.1fus  max %.1fus\n", names[i], histograms[i]->count(),
+                     histograms[i]->percentile(50) / 1e3, histograms[i]->percentile(99) / 1e3,
+                     histograms[i]->percentile(99.9) / 1e3, histograms[i]->max() / 1e3);
+        out << buffer;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// HDR-style histogram: values are grouped by their power of two and then
+// split linearly into 64 steps, so any recorded value is reported with a
+// relative error below 1/64 while the whole 64-bit range fits in a few
+// thousand counters.
+class Histogram
+{
+public:
+    Histogram();
+
+    void record(unsigned long long value);
+    void reset();
+    unsigned long long count() const;
+    unsigned long long max() const;
+
+    // the smallest value that at least p percent of the recorded values
+    // do not exceed
+    unsigned long long percentile(double p) const;
+
+private:
+    static std::size_t bucket(unsigned long long value);
+    static unsigned long long highest(std::size_t bucket);
+
+    std::vector<unsigned long long> counts_;
+    unsigned long long              count_;
+    unsigned long long              max_;
+};
+
+// monotonic clock in nanoseconds
+unsigned long long nanoseconds();
+
+// Parse and eval latencies of the top-level forms the REPL reads, kept
+// when --latency-stats or --slow-form-ms is given. Forms slower than the
+// threshold are logged to stderr with their allocation counts.
+class LatencyStats
+{
+public:
+    static void enable();
+    static void logSlowForms(double ms);
+    static bool enabled();
+    static void record(const std::string& source, unsigned long long parseNs, unsigned long long evalNs,
+                       std::size_t parseAllocations, std::size_t evalAllocations);
+    static const Histogram& parse();
+    static const Histogram& eval();
+    static void report(std::ostream& out);
+
+private:
+    static bool      enabled_;
+    static double    slowMs_;
+    static Histogram parse_;
+    static Histogram eval_;
+};
+
+#endif//HISTOGRAM_H
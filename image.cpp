@@ -0,0 +1,456 @@
+#include "image.h"
+#include "binary.h"
+#include "bignum.h"
+#include "functions.h"
+#include "macro.h"
+#include "hash.h"
+#include "persistent.h"
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+const char Magic[] = "liscpp-image-2";
+
+enum Tag { NullTag, IntegerTag, RealTag, BoolTag, SymbolTag, NodeTag, LambdaTag, PrimitiveTag, BignumTag, TransformerTag, SyntaxRulesTag,
+           HashTag, VectorTag, MapTag };
+
+// promises and open files have no saved form
+class Unsaveable : public std::runtime_error
+{
+public:
+    explicit Unsaveable(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Objects are numbered from 1 in the order they are written, and every
+// reference points backwards, so loading is a single forward pass that
+// turns indices into pointers. Index 0 stands for a null pointer. Hash
+// tables are the exception: they may contain themselves, so they are
+// written empty and their entries follow the objects as (table, key,
+// value) triples.
+class ImageWriter
+{
+public:
+    explicit ImageWriter(const Env& env) : env_(env), count_(0)
+    {
+        // primitives are identified by the name appendFunctions gave them,
+        // which is their oldest binding
+        const Env::Dictionary& dictionary = env.dictionary();
+        for(Env::Dictionary::const_iterator i = dictionary.begin(); i != dictionary.end(); ++i)
+        {
+            if((dynamic_cast<const Function*>(i->second) != 0) && (dynamic_cast<const Lambda*>(i->second) == 0))
+            {
+                primitives_[i->second] = i->first;
+            }
+        }
+    }
+
+    void save(const std::string& path)
+    {
+        const Env::Dictionary& dictionary = env_.dictionary();
+        std::vector<std::pair<std::string, unsigned long long> > bindings;
+        for(Env::Dictionary::const_reverse_iterator i = dictionary.rbegin(); i != dictionary.rend(); ++i)
+        {
+            try
+            {
+                bindings.push_back(std::make_pair(i->first, index(i->second)));
+            }
+            catch(const Unsaveable& e)
+            {
+                std::cerr << "warning: not saving " << i->first << ": " << e.what() << std::endl;
+            }
+        }
+
+        BinaryWriter image;
+        image.raw(Magic, sizeof(Magic));
+        image.varint(count_);
+        image.raw(objects_.data().data(), objects_.data().size());
+        image.varint(fills_.size() / 3);
+        for(std::vector<unsigned long long>::const_iterator i = fills_.begin(); i != fills_.end(); ++i)
+        {
+            image.varint(*i);
+        }
+        image.varint(bindings.size());
+        for(std::vector<std::pair<std::string, unsigned long long> >::const_iterator i = bindings.begin(); i != bindings.end(); ++i)
+        {
+            image.string(i->first);
+            image.varint(i->second);
+        }
+        image.save(path);
+    }
+
+private:
+    unsigned long long index(const Atom* atom)
+    {
+        if(atom == 0)
+        {
+            return 0;
+        }
+        std::map<const Atom*, unsigned long long>::const_iterator found = indices_.find(atom);
+        if(found != indices_.end())
+        {
+            return found->second;
+        }
+
+        if(atom == Node::getNull())
+        {
+            objects_.byte(NullTag);
+        }
+        else if(const Node* node = dynamic_cast<const Node*>(atom))
+        {
+            return list(node);
+        }
+        else if(const Lambda* lambda = dynamic_cast<const Lambda*>(atom))
+        {
+            unsigned long long args = index(lambda->args());
+            unsigned long long exp  = index(lambda->exp());
+            objects_.byte(LambdaTag);
+            objects_.varint(args);
+            objects_.varint(exp);
+        }
+        else if(const Transformer* t = dynamic_cast<const Transformer*>(atom))
+        {
+            unsigned long long function = index(t->function());
+            objects_.byte(TransformerTag);
+            objects_.varint(function);
+        }
+        else if(const SyntaxRules* s = dynamic_cast<const SyntaxRules*>(atom))
+        {
+            unsigned long long spec = index(s->spec());
+            objects_.byte(SyntaxRulesTag);
+            objects_.varint(spec);
+        }
+        else if(const Integer* i = dynamic_cast<const Integer*>(atom))
+        {
+            objects_.byte(IntegerTag);
+            objects_.integer(i->value());
+        }
+        else if(const Bignum* n = dynamic_cast<const Bignum*>(atom))
+        {
+            objects_.byte(BignumTag);
+            objects_.bignum(n->value());
+        }
+        else if(const Real* r = dynamic_cast<const Real*>(atom))
+        {
+            objects_.byte(RealTag);
+            objects_.real(r->value());
+        }
+        else if(const Bool* b = dynamic_cast<const Bool*>(atom))
+        {
+            objects_.byte(BoolTag);
+            objects_.byte(b->value() ? 1 : 0);
+        }
+        else if(const Symbol* s = dynamic_cast<const Symbol*>(atom))
+        {
+            objects_.byte(SymbolTag);
+            objects_.string(s->value());
+        }
+        else if(const HashTable* h = dynamic_cast<const HashTable*>(atom))
+        {
+            return table(h);
+        }
+        else if(const Vector* v = dynamic_cast<const Vector*>(atom))
+        {
+            std::vector<unsigned long long> items;
+            for(std::size_t i = 0; i < v->size(); ++i)
+            {
+                items.push_back(index(v->ref(i)));
+            }
+            objects_.byte(VectorTag);
+            objects_.varint(items.size());
+            for(std::vector<unsigned long long>::const_iterator i = items.begin(); i != items.end(); ++i)
+            {
+                objects_.varint(*i);
+            }
+        }
+        else if(const Map* m = dynamic_cast<const Map*>(atom))
+        {
+            Map::Pairs pairs;
+            m->pairs(pairs);
+            std::vector<unsigned long long> items;
+            for(Map::Pairs::const_iterator i = pairs.begin(); i != pairs.end(); ++i)
+            {
+                items.push_back(index(i->first));
+                items.push_back(index(i->second));
+            }
+            objects_.byte(MapTag);
+            objects_.varint(pairs.size());
+            for(std::vector<unsigned long long>::const_iterator i = items.begin(); i != items.end(); ++i)
+            {
+                objects_.varint(*i);
+            }
+        }
+        else if(primitives_.find(atom) != primitives_.end())
+        {
+            objects_.byte(PrimitiveTag);
+            objects_.string(primitives_[atom]);
+        }
+        else
+        {
+            std::stringstream ss;
+            ss << *atom;
+            throw Unsaveable("cannot save " + ss.str());
+        }
+        return indices_[atom] = ++count_;
+    }
+
+    // entries that cannot be saved are left out of the table
+    unsigned long long table(const HashTable* h)
+    {
+        objects_.byte(HashTag);
+        unsigned long long self = indices_[h] = ++count_;
+
+        HashTable::Pairs pairs;
+        h->pairs(pairs);
+        for(HashTable::Pairs::const_iterator i = pairs.begin(); i != pairs.end(); ++i)
+        {
+            try
+            {
+                unsigned long long key   = index(i->first);
+                unsigned long long value = index(i->second);
+                fills_.push_back(self);
+                fills_.push_back(key);
+                fills_.push_back(value);
+            }
+            catch(const Unsaveable& e)
+            {
+                std::cerr << "warning: not saving a hash table entry: " << e.what() << std::endl;
+            }
+        }
+        return self;
+    }
+
+    // walks the cdr chain iteratively so that long lists do not recurse
+    unsigned long long list(const Node* node)
+    {
+        std::vector<const Node*> cells;
+        const Node* tail = node;
+        while((tail != 0) && (tail != Node::getNull()) && (indices_.find(tail) == indices_.end()))
+        {
+            cells.push_back(tail);
+            tail = tail->cdr();
+        }
+
+        unsigned long long cdr = index(tail);
+        std::vector<unsigned long long> cars;
+        for(std::vector<const Node*>::const_iterator i = cells.begin(); i != cells.end(); ++i)
+        {
+            cars.push_back(index((*i)->car()));
+        }
+
+        for(std::size_t i = cells.size(); i > 0; --i)
+        {
+            std::map<const Atom*, unsigned long long>::const_iterator found = indices_.find(cells[i - 1]);
+            if(found != indices_.end())
+            {
+                cdr = found->second;
+                continue;
+            }
+            objects_.byte(NodeTag);
+            objects_.varint(cars[i - 1]);
+            objects_.varint(cdr);
+            cdr = indices_[cells[i - 1]] = ++count_;
+        }
+        return cdr;
+    }
+
+    const Env&                                env_;
+    std::map<const Atom*, std::string>        primitives_;
+    std::map<const Atom*, unsigned long long> indices_;
+    BinaryWriter                              objects_;
+    std::vector<unsigned long long>           fills_;     // hash table, key, value
+    unsigned long long                        count_;
+};
+
+} // end of anonymous namespace
+
+void saveImage(const std::string& path, const Env& env)
+{
+    ImageWriter(env).save(path);
+}
+
+void loadImage(const std::string& path, Env& env)
+{
+    MappedFile   file(path);
+    BinaryReader in(file.begin(), file.end());
+    for(const char* c = Magic; c != Magic + sizeof(Magic); ++c)
+    {
+        if(in.byte() != static_cast<unsigned char>(*c))
+        {
+            throw std::runtime_error(path + " is not an image");
+        }
+    }
+
+    Env primitives;
+    appendFunctions(primitives);
+
+    std::vector<const Atom*> table(1, static_cast<const Atom*>(0));
+    unsigned long long count = in.count();
+    table.reserve(count + 1);
+
+    // references point back at objects already read; only the cdr of
+    // a cell may be null
+    struct _
+    {
+        static const Atom* at(BinaryReader& in, const std::vector<const Atom*>& table)
+        {
+            unsigned long long i = in.varint();
+            if(i >= table.size())
+            {
+                throw std::runtime_error("corrupt image");
+            }
+            return table[i];
+        }
+
+        static const Atom* ref(BinaryReader& in, const std::vector<const Atom*>& table)
+        {
+            const Atom* atom = at(in, table);
+            if(atom == 0)
+            {
+                throw std::runtime_error("corrupt image");
+            }
+            return atom;
+        }
+
+        static const Node* cdr(BinaryReader& in, const std::vector<const Atom*>& table)
+        {
+            const Atom* atom = at(in, table);
+            const Node* node = dynamic_cast<const Node*>(atom);
+            if((atom != 0) && (node == 0))
+            {
+                throw std::runtime_error("corrupt image");
+            }
+            return node;
+        }
+
+        static const Node* node(BinaryReader& in, const std::vector<const Atom*>& table)
+        {
+            const Node* node = cdr(in, table);
+            if(node == 0)
+            {
+                throw std::runtime_error("corrupt image");
+            }
+            return node;
+        }
+
+        static const Function* function(BinaryReader& in, const std::vector<const Atom*>& table)
+        {
+            const Function* function = dynamic_cast<const Function*>(ref(in, table));
+            if(function == 0)
+            {
+                throw std::runtime_error("corrupt image");
+            }
+            return function;
+        }
+    };
+
+    for(unsigned long long i = 0; i < count; ++i)
+    {
+        switch(in.byte())
+        {
+        case NullTag:
+            table.push_back(Node::getNull());
+            break;
+
+        case IntegerTag:
+            table.push_back(new Integer(in.integer()));
+            break;
+
+        case BignumTag:
+            table.push_back(Bignum::create(in.bignum()));
+            break;
+
+        case RealTag:
+            table.push_back(new Real(in.real()));
+            break;
+
+        case BoolTag:
+            table.push_back(new Bool(in.byte() != 0));
+            break;
+
+        case SymbolTag:
+            table.push_back(new Symbol(in.string()));
+            break;
+
+        case NodeTag:
+            {
+                const Atom* car = _::ref(in, table);
+                const Node* cdr = _::cdr(in, table);
+                table.push_back(new Node(car, cdr));
+            }
+            break;
+
+        case LambdaTag:
+            {
+                const Node* args = _::node(in, table);
+                const Node* exp  = _::node(in, table);
+                table.push_back(new Lambda(args, exp));
+            }
+            break;
+
+        case TransformerTag:
+            table.push_back(new Transformer(_::function(in, table)));
+            break;
+
+        case SyntaxRulesTag:
+            table.push_back(new SyntaxRules(_::node(in, table)));
+            break;
+
+        case PrimitiveTag:
+            table.push_back(primitives.find(in.string()));
+            break;
+
+        case HashTag:
+            table.push_back(new HashTable);
+            break;
+
+        case VectorTag:
+            {
+                std::vector<const Atom*> items;
+                for(unsigned long long n = in.count(); n > 0; --n)
+                {
+                    items.push_back(_::ref(in, table));
+                }
+                table.push_back(Vector::create(items));
+            }
+            break;
+
+        case MapTag:
+            {
+                const Map* map = new Map;
+                for(unsigned long long n = in.count(); n > 0; --n)
+                {
+                    const Atom* key = _::ref(in, table);
+                    map = map->set(key, _::ref(in, table));
+                }
+                table.push_back(map);
+            }
+            break;
+
+        default:
+            throw std::runtime_error("corrupt image");
+        }
+    }
+
+    for(unsigned long long n = in.count(); n > 0; --n)
+    {
+        const HashTable* h = dynamic_cast<const HashTable*>(_::ref(in, table));
+        if(h == 0)
+        {
+            throw std::runtime_error("corrupt image");
+        }
+        const Atom* key = _::ref(in, table);
+        h->set(key, _::ref(in, table));
+    }
+
+    for(unsigned long long n = in.count(); n > 0; --n)
+    {
+        std::string key = in.string();
+        env.push(key, _::ref(in, table));
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "atoms.h"
+
+#include <string>
+
+void saveImage(const std::string& path, const Env& env);
+void loadImage(const std::string& path, Env& env);
+
+#endif//IMAGE_H
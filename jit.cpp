@@ -0,0 +1,541 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <typeinfo>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+int NativeCode::threshold_ = 0;
+
+namespace
+{
+
+typedef std::map<const Atom*, NativeCode::Operation> Intrinsics;
+
+const std::size_t MaxParams = 16;
+
+Intrinsics& intrinsics()
+{
+    static Intrinsics table;
+    return table;
+}
+
+class Assembler
+{
+public:
+    void emit(unsigned char b)
+    {
+        code_.push_back(b);
+    }
+
+    void emit(unsigned char b1, unsigned char b2)
+    {
+        emit(b1);
+        emit(b2);
+    }
+
+    void emit(unsigned char b1, unsigned char b2, unsigned char b3)
+    {
+        emit(b1, b2);
+        emit(b3);
+    }
+
+    void imm32(int value)
+    {
+        for(int i = 0; i < 4; ++i)
+        {
+            emit(static_cast<unsigned char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    void imm64(long long value)
+    {
+        for(int i = 0; i < 8; ++i)
+        {
+            emit(static_cast<unsigned char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    std::size_t here() const
+    {
+        return code_.size();
+    }
+
+    // emits a rel32 placeholder and returns its position for patch()
+    std::size_t label()
+    {
+        std::size_t at = here();
+        imm32(0);
+        return at;
+    }
+
+    void patch(std::size_t at)
+    {
+        int rel = static_cast<int>(here() - (at + 4));
+        for(int i = 0; i < 4; ++i)
+        {
+            code_[at + i] = static_cast<unsigned char>((rel >> (i * 8)) & 0xff);
+        }
+    }
+
+    void call(std::size_t target)
+    {
+        emit(0xe8);
+        imm32(static_cast<int>(target - (here() + 4)));
+    }
+
+    // conditional jump (0f cc rel32) to an already emitted target
+    void jump(unsigned char cc, std::size_t target)
+    {
+        emit(0x0f, cc);
+        imm32(static_cast<int>(target - (here() + 4)));
+    }
+
+    const std::vector<unsigned char>& code() const
+    {
+        return code_;
+    }
+
+private:
+    std::vector<unsigned char> code_;
+};
+
+// Stitches per-operation templates into
+// `long long f(const long long* args, int* bailed)`.
+// Every value lives in rax; the left operand of a binary operation is
+// spilled with push/pop, and arguments of a self call are stored in a
+// stack block whose address is passed in rdi.
+//
+// A stub in front of the body saves the stack pointer in rbx. When an
+// operation overflows (or divides by 0 or -1) the code jumps to the bail
+// stub, which unwinds every recursive frame at once and sets *bailed;
+// the caller then interprets the call instead. Compiled bodies only do
+// arithmetic, so nothing has to be undone.
+class Compiler
+{
+public:
+    Compiler(const Lambda* lambda, const Env& env) : lambda_(lambda), env_(env), bail_(0), body_(0)
+    {
+    }
+
+    bool compile()
+    {
+        for(Node::Iterator i(lambda_->args()); i.good(); ++i)
+        {
+            const Symbol* param = dynamic_cast<const Symbol*>(i->car());
+            if((param == 0) || (params_.size() == MaxParams))
+            {
+                return false;
+            }
+            params_.push_back(param->value());
+        }
+
+        asm_.emit(0x53);                // push rbx
+        asm_.emit(0x41, 0x54);          // push r12
+        asm_.emit(0x49, 0x89, 0xf4);    // mov  r12, rsi
+        asm_.emit(0x48, 0x89, 0xe3);    // mov  rbx, rsp
+        asm_.emit(0xe8);                // call body
+        std::size_t body = asm_.label();
+        asm_.emit(0x41, 0x5c);          // pop  r12
+        asm_.emit(0x5b);                // pop  rbx
+        asm_.emit(0xc3);                // ret
+
+        bail_ = asm_.here();
+        asm_.emit(0x48, 0x89, 0xdc);    // mov  rsp, rbx
+        asm_.emit(0x41, 0xc7, 0x04);    // mov  dword [r12], 1
+        asm_.emit(0x24);
+        asm_.imm32(1);
+        asm_.emit(0x41, 0x5c);          // pop  r12
+        asm_.emit(0x5b);                // pop  rbx
+        asm_.emit(0xc3);                // ret
+
+        body_ = asm_.here();
+        asm_.patch(body);
+        asm_.emit(0x55);                // push rbp
+        asm_.emit(0x48, 0x89, 0xe5);    // mov  rbp, rsp
+        asm_.emit(0x57);                // push rdi
+        asm_.emit(0x57);                // push rdi
+
+        if( ! expression(lambda_->exp()))
+        {
+            return false;
+        }
+
+        asm_.emit(0xc9);                // leave
+        asm_.emit(0xc3);                // ret
+        return true;
+    }
+
+    const std::vector<std::string>& params() const
+    {
+        return params_;
+    }
+
+    const std::vector<std::pair<std::string, const Atom*> >& guards() const
+    {
+        return guards_;
+    }
+
+    const std::vector<unsigned char>& code() const
+    {
+        return asm_.code();
+    }
+
+private:
+    enum Callee { Self, Intrinsic, Unknown };
+
+    static std::vector<const Atom*> elements(const Node* node)
+    {
+        std::vector<const Atom*> result;
+        for(Node::Iterator i(node); i.good(); ++i)
+        {
+            result.push_back(i->car());
+        }
+        return result;
+    }
+
+    int param(const std::string& name) const
+    {
+        for(std::size_t i = 0; i < params_.size(); ++i)
+        {
+            if(params_[i] == name)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    Callee resolve(const Atom* head, NativeCode::Operation& operation)
+    {
+        const Symbol* symbol = dynamic_cast<const Symbol*>(head);
+        if((symbol == 0) || (param(symbol->value()) >= 0))
+        {
+            return Unknown;
+        }
+
+        const Atom* function = 0;
+        try
+        {
+            function = env_.find(symbol->value());
+        }
+        catch(const std::runtime_error&)
+        {
+            return Unknown;
+        }
+
+        Callee callee = Unknown;
+        if(function == lambda_)
+        {
+            callee = Self;
+        }
+        else
+        {
+            Intrinsics::const_iterator i = intrinsics().find(function);
+            if(i != intrinsics().end())
+            {
+                operation = i->second;
+                callee    = Intrinsic;
+            }
+        }
+
+        if(callee != Unknown)
+        {
+            guards_.push_back(std::make_pair(symbol->value(), function));
+        }
+        return callee;
+    }
+
+    bool operands(const std::vector<const Atom*>& form)
+    {
+        if(form.size() != 3)
+        {
+            return false;
+        }
+        if( ! expression(form[1]))
+        {
+            return false;
+        }
+        asm_.emit(0x50);                // push rax
+        if( ! expression(form[2]))
+        {
+            return false;
+        }
+        asm_.emit(0x48, 0x89, 0xc1);    // mov  rcx, rax
+        asm_.emit(0x58);                // pop  rax
+        return true;
+    }
+
+    bool expression(const Atom* atom)
+    {
+        if(typeid(*atom) == typeid(Integer))
+        {
+            long long value = static_cast<const Integer*>(atom)->value();
+            if((value >= -0x80000000LL) && (value <= 0x7fffffffLL))
+            {
+                asm_.emit(0x48, 0xc7, 0xc0);    // mov  rax, simm32
+                asm_.imm32(static_cast<int>(value));
+            }
+            else
+            {
+                asm_.emit(0x48, 0xb8);          // mov  rax, imm64
+                asm_.imm64(value);
+            }
+            return true;
+        }
+
+        if(typeid(*atom) == typeid(Symbol))
+        {
+            int i = param(static_cast<const Symbol*>(atom)->value());
+            if(i < 0)
+            {
+                return false;
+            }
+            asm_.emit(0x48, 0x8b, 0x4d);    // mov  rcx, [rbp - 8]
+            asm_.emit(0xf8);
+            asm_.emit(0x48, 0x8b, 0x81);    // mov  rax, [rcx + disp32]
+            asm_.imm32(i * 8);
+            return true;
+        }
+
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if((node == 0) || (node == Node::getNull()))
+        {
+            return false;
+        }
+
+        std::vector<const Atom*> form = elements(node);
+        const Symbol* head = dynamic_cast<const Symbol*>(form[0]);
+        if((head != 0) && (head->value() == "if"))
+        {
+            return branch(form);
+        }
+
+        NativeCode::Operation operation = NativeCode::Add;
+        switch(resolve(form[0], operation))
+        {
+        case Self:      return call(form);
+        case Intrinsic: return arithmetic(operation, form);
+        default:        return false;
+        }
+    }
+
+    bool arithmetic(NativeCode::Operation operation, const std::vector<const Atom*>& form)
+    {
+        if( ! operands(form))
+        {
+            return false;
+        }
+        switch(operation)
+        {
+        case NativeCode::Add:
+            asm_.emit(0x48, 0x01, 0xc8);        // add  rax, rcx
+            break;
+
+        case NativeCode::Subtract:
+            asm_.emit(0x48, 0x29, 0xc8);        // sub  rax, rcx
+            break;
+
+        case NativeCode::Multiply:
+            asm_.emit(0x48, 0x0f, 0xaf);        // imul rax, rcx
+            asm_.emit(0xc1);
+            break;
+
+        case NativeCode::Divide:
+            asm_.emit(0x48, 0x85, 0xc9);        // test rcx, rcx
+            asm_.jump(0x84, bail_);             // jz   bail
+            asm_.emit(0x48, 0x83, 0xf9);        // cmp  rcx, -1
+            asm_.emit(0xff);
+            asm_.jump(0x84, bail_);             // je   bail
+            asm_.emit(0x48, 0x99);              // cqo
+            asm_.emit(0x48, 0xf7, 0xf9);        // idiv rcx
+            return true;
+
+        default:
+            return false;
+        }
+        asm_.jump(0x80, bail_);                 // jo   bail
+        return true;
+    }
+
+    // emits a jump taken when the comparison is false; returns its label
+    bool condition(const Atom* atom, std::size_t& label)
+    {
+        const Node* node = dynamic_cast<const Node*>(atom);
+        if((node == 0) || (node == Node::getNull()))
+        {
+            return false;
+        }
+
+        std::vector<const Atom*> form = elements(node);
+        NativeCode::Operation operation = NativeCode::Add;
+        if((resolve(form[0], operation) != Intrinsic) || ! operands(form))
+        {
+            return false;
+        }
+
+        asm_.emit(0x48, 0x39, 0xc8);    // cmp  rax, rcx
+        switch(operation)
+        {
+        case NativeCode::Less:         asm_.emit(0x0f, 0x8d); break;    // jge
+        case NativeCode::Greater:      asm_.emit(0x0f, 0x8e); break;    // jle
+        case NativeCode::LessEqual:    asm_.emit(0x0f, 0x8f); break;    // jg
+        case NativeCode::GreaterEqual: asm_.emit(0x0f, 0x8c); break;    // jl
+        case NativeCode::Equal:        asm_.emit(0x0f, 0x85); break;    // jne
+        default:                       return false;
+        }
+        label = asm_.label();
+        return true;
+    }
+
+    bool branch(const std::vector<const Atom*>& form)
+    {
+        std::size_t alt = 0;
+        if((form.size() != 4) || ! condition(form[1], alt) || ! expression(form[2]))
+        {
+            return false;
+        }
+        asm_.emit(0xe9);                // jmp  rel32
+        std::size_t end = asm_.label();
+        asm_.patch(alt);
+        if( ! expression(form[3]))
+        {
+            return false;
+        }
+        asm_.patch(end);
+        return true;
+    }
+
+    bool call(const std::vector<const Atom*>& form)
+    {
+        if(form.size() != params_.size() + 1)
+        {
+            return false;
+        }
+
+        int block = static_cast<int>((params_.size() * 8 + 15) & ~15);
+        asm_.emit(0x48, 0x81, 0xec);    // sub  rsp, imm32
+        asm_.imm32(block);
+        for(std::size_t i = 0; i < params_.size(); ++i)
+        {
+            if( ! expression(form[i + 1]))
+            {
+                return false;
+            }
+            asm_.emit(0x48, 0x89, 0x84);    // mov  [rsp + disp32], rax
+            asm_.emit(0x24);
+            asm_.imm32(static_cast<int>(i * 8));
+        }
+        asm_.emit(0x48, 0x89, 0xe7);    // mov  rdi, rsp
+        asm_.call(body_);
+        asm_.emit(0x48, 0x81, 0xc4);    // add  rsp, imm32
+        asm_.imm32(block);
+        return true;
+    }
+
+    const Lambda*                                     lambda_;
+    const Env&                                        env_;
+    std::vector<std::string>                          params_;
+    std::vector<std::pair<std::string, const Atom*> > guards_;
+    Assembler                                         asm_;
+    std::size_t                                       bail_;
+    std::size_t                                       body_;
+};
+
+} // end of anonymous namespace
+
+void NativeCode::enable(int threshold)
+{
+    threshold_ = threshold;
+}
+
+int NativeCode::threshold()
+{
+    return threshold_;
+}
+
+void NativeCode::intrinsic(const Atom* function, Operation operation)
+{
+    intrinsics()[function] = operation;
+}
+
+const NativeCode* NativeCode::compile(const Lambda* lambda, const Env& env)
+{
+#if defined(__x86_64__)
+    Compiler compiler(lambda, env);
+    if( ! compiler.compile())
+    {
+        return 0;
+    }
+    NativeCode* native = new NativeCode(compiler.params(), compiler.guards(), compiler.code());
+    if(native->entry_ == 0)
+    {
+        // the lambda stays interpreted
+        delete native;
+        return 0;
+    }
+    return native;
+#else
+    return 0;
+#endif
+}
+
+NativeCode::NativeCode(const std::vector<std::string>& params, const Guards& guards, const std::vector<unsigned char>& code)
+    : params_(params), guards_(guards), buffer_(0), size_(code.size()), entry_(0)
+{
+#if defined(__x86_64__)
+    // entry_ stays 0 when no executable memory can be had
+    buffer_ = mmap(0, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffer_ == MAP_FAILED)
+    {
+        buffer_ = 0;
+        return;
+    }
+    std::copy(code.begin(), code.end(), static_cast<unsigned char*>(buffer_));
+    if(mprotect(buffer_, size_, PROT_READ | PROT_EXEC) != 0)
+    {
+        return;
+    }
+    entry_ = reinterpret_cast<Entry>(buffer_);
+#endif
+}
+
+NativeCode::~NativeCode()
+{
+#if defined(__x86_64__)
+    if(buffer_ != 0)
+    {
+        munmap(buffer_, size_);
+    }
+#endif
+}
+
+const Atom* NativeCode::call(Env& env) const
+{
+    for(Guards::const_iterator i = guards_.begin(); i != guards_.end(); ++i)
+    {
+        if(env.find(i->first) != i->second)
+        {
+            return 0;
+        }
+    }
+
+    long long args[MaxParams];
+    for(std::size_t i = 0; i < params_.size(); ++i)
+    {
+        const Atom* arg = env.find(params_[i]);
+        if(typeid(*arg) != typeid(Integer))
+        {
+            return 0;
+        }
+        args[i] = static_cast<const Integer*>(arg)->value();
+    }
+
+    int bailed = 0;
+    long long result = entry_(args, &bailed);
+    return bailed ? 0 : new Integer(result);
+}
@@ -0,0 +1,39 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "atoms.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class NativeCode
+{
+public:
+    enum Operation { Add, Subtract, Multiply, Divide, Less, Greater, LessEqual, GreaterEqual, Equal };
+
+    static void enable(int threshold);
+    static int threshold();
+    static void intrinsic(const Atom* function, Operation operation);
+
+    static const NativeCode* compile(const Lambda* lambda, const Env& env);
+
+    ~NativeCode();
+    const Atom* call(Env& env) const;
+
+private:
+    typedef long long (*Entry)(const long long* args, int* bailed);
+    typedef std::vector<std::pair<std::string, const Atom*> > Guards;
+
+    NativeCode(const std::vector<std::string>& params, const Guards& guards, const std::vector<unsigned char>& code);
+
+    std::vector<std::string> params_;
+    Guards                   guards_;
+    void*                    buffer_;
+    std::size_t              size_;
+    Entry                    entry_;
+
+    static int threshold_;
+};
+
+#endif//JIT_H
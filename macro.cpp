@@ -0,0 +1,294 @@
+#include "macro.h"
+#include "hash.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+
+unsigned long expansions = 0;
+
+const Symbol* symbol(const Atom* atom)
+{
+    return dynamic_cast<const Symbol*>(atom);
+}
+
+std::size_t count(Node::Iterator i)
+{
+    std::size_t n = 0;
+    for(; i.good(); ++i)
+    {
+        ++n;
+    }
+    return n;
+}
+
+} // end of anonymous namespace
+
+Transformer::Transformer(const Function* function) : function_(function)
+{
+    pool_.push_back(this);
+}
+
+const Atom* Transformer::expand(const Node* form, Env& env) const
+{
+    Frame frame(function_, env);
+    for(Node::Iterator v(form); frame.accepts(*v); ++v)
+    {
+        frame.push(v->car());
+    }
+    return frame.invoke();
+}
+
+const Function* Transformer::function() const
+{
+    return function_;
+}
+
+SyntaxRules::SyntaxRules(const Node* spec) : spec_(spec)
+{
+    Node::Iterator i(spec);
+    const Symbol* keyword = symbol(i.good() ? i->car() : 0);
+    assert_((keyword != 0) && (keyword->value() == "syntax-rules"), "syntax-rules expected");
+
+    for(Node::Iterator literal((++i)->car()->as<Node>()); literal.good(); ++literal)
+    {
+        literals_.insert(literal->car()->as<Symbol>()->value());
+    }
+
+    for(++i; i.good(); ++i)
+    {
+        Node::Iterator clause(i->car()->as<Node>());
+        Rule rule;
+        rule.pattern = (clause++)->car()->as<Node>()->cdr();
+        rule.tmpl    = clause->car();
+
+        std::set<std::string> patternVariables;
+        variables(rule.pattern, patternVariables);
+        binders(rule.tmpl, patternVariables, rule.binders);
+        rules_.push_back(rule);
+    }
+}
+
+const Atom* SyntaxRules::expand(const Node* form, Env&) const
+{
+    for(Rules::const_iterator rule = rules_.begin(); rule != rules_.end(); ++rule)
+    {
+        Bindings bindings;
+        if( ! matchList(Node::Iterator(rule->pattern), Node::Iterator(form), bindings))
+        {
+            continue;
+        }
+
+        Renames renames;
+        ++expansions;
+        for(std::set<std::string>::const_iterator name = rule->binders.begin(); name != rule->binders.end(); ++name)
+        {
+            std::ostringstream ss;
+            ss << " " << *name << "." << expansions;
+            renames[*name] = ss.str();
+        }
+        return instantiate(rule->tmpl, bindings, renames);
+    }
+
+    std::ostringstream ss;
+    ss << *form;
+    throw std::runtime_error("no syntax rule matches " + ss.str());
+}
+
+const Node* SyntaxRules::spec() const
+{
+    return spec_;
+}
+
+bool SyntaxRules::isEllipsis(const Atom* atom) const
+{
+    const Symbol* s = symbol(atom);
+    return (s != 0) && (s->value() == "...");
+}
+
+void SyntaxRules::variables(const Atom* pattern, std::set<std::string>& names) const
+{
+    if(const Symbol* s = symbol(pattern))
+    {
+        if(( ! isEllipsis(s)) && (s->value() != "_") && (literals_.count(s->value()) == 0))
+        {
+            names.insert(s->value());
+        }
+    }
+    for(Node::Iterator i(dynamic_cast<const Node*>(pattern)); i.good(); ++i)
+    {
+        variables(i->car(), names);
+    }
+}
+
+// collects the parameters of every lambda the template itself writes
+void SyntaxRules::binders(const Atom* tmpl, const std::set<std::string>& patternVariables, std::set<std::string>& names) const
+{
+    Node::Iterator i(dynamic_cast<const Node*>(tmpl));
+    if( ! i.good())
+    {
+        return;
+    }
+
+    const Symbol* head = symbol(i->car());
+    Node::Iterator next(i);
+    ++next;
+    if((head != 0) && (head->value() == "lambda") && next.good())
+    {
+        for(Node::Iterator param(dynamic_cast<const Node*>(next->car())); param.good(); ++param)
+        {
+            const Symbol* s = symbol(param->car());
+            if((s != 0) && ( ! isEllipsis(s)) && (patternVariables.count(s->value()) == 0))
+            {
+                names.insert(s->value());
+            }
+        }
+    }
+    for(; i.good(); ++i)
+    {
+        binders(i->car(), patternVariables, names);
+    }
+}
+
+bool SyntaxRules::match(const Atom* pattern, const Atom* form, Bindings& bindings) const
+{
+    if(const Symbol* s = symbol(pattern))
+    {
+        if(s->value() == "_")
+        {
+            return true;
+        }
+        if(literals_.count(s->value()) != 0)
+        {
+            const Symbol* other = symbol(form);
+            return (other != 0) && (other->value() == s->value());
+        }
+        bindings[s->value()].atom = form;
+        return true;
+    }
+    if(const Node* node = dynamic_cast<const Node*>(pattern))
+    {
+        const Node* other = dynamic_cast<const Node*>(form);
+        return (other != 0) && matchList(Node::Iterator(node), Node::Iterator(other), bindings);
+    }
+    return equalAtoms(pattern, form);
+}
+
+bool SyntaxRules::matchList(Node::Iterator pattern, Node::Iterator form, Bindings& bindings) const
+{
+    for(; pattern.good(); ++pattern)
+    {
+        Node::Iterator next(pattern);
+        ++next;
+        if( ! (next.good() && isEllipsis(next->car())))
+        {
+            if(( ! form.good()) || ( ! match(pattern->car(), form->car(), bindings)))
+            {
+                return false;
+            }
+            ++form;
+            continue;
+        }
+
+        // leave enough elements for the rest of the pattern
+        Node::Iterator rest(next);
+        ++rest;
+        std::size_t tail      = count(rest);
+        std::size_t available = count(form);
+        if(available < tail)
+        {
+            return false;
+        }
+
+        std::set<std::string> names;
+        variables(pattern->car(), names);
+        std::vector<Bindings> repetitions(available - tail);
+        for(std::vector<Bindings>::iterator r = repetitions.begin(); r != repetitions.end(); ++r, ++form)
+        {
+            if( ! match(pattern->car(), form->car(), *r))
+            {
+                return false;
+            }
+        }
+        for(std::set<std::string>::const_iterator name = names.begin(); name != names.end(); ++name)
+        {
+            Match& gathered = bindings[*name];
+            for(std::vector<Bindings>::iterator r = repetitions.begin(); r != repetitions.end(); ++r)
+            {
+                gathered.items.push_back((*r)[*name]);
+            }
+        }
+        pattern = next;
+    }
+    return ! form.good();
+}
+
+const Atom* SyntaxRules::instantiate(const Atom* tmpl, const Bindings& bindings, const Renames& renames) const
+{
+    if(const Symbol* s = symbol(tmpl))
+    {
+        Bindings::const_iterator bound = bindings.find(s->value());
+        if(bound != bindings.end())
+        {
+            assert_(bound->second.atom != 0, s->value() + " must be followed by ...");
+            return bound->second.atom;
+        }
+        Renames::const_iterator renamed = renames.find(s->value());
+        return (renamed != renames.end()) ? new Symbol(renamed->second) : tmpl;
+    }
+
+    const Node* node = dynamic_cast<const Node*>(tmpl);
+    if((node == 0) || (node == Node::getNull()))
+    {
+        return tmpl;
+    }
+
+    std::vector<const Atom*> atoms;
+    for(Node::Iterator i(node); i.good(); ++i)
+    {
+        Node::Iterator next(i);
+        ++next;
+        if( ! (next.good() && isEllipsis(next->car())))
+        {
+            atoms.push_back(instantiate(i->car(), bindings, renames));
+            continue;
+        }
+
+        // every variable of the element that matched under ... steps together
+        std::set<std::string> names;
+        variables(i->car(), names);
+        std::vector<std::string> repeated;
+        std::size_t n = 0;
+        for(std::set<std::string>::const_iterator name = names.begin(); name != names.end(); ++name)
+        {
+            Bindings::const_iterator bound = bindings.find(*name);
+            if((bound != bindings.end()) && (bound->second.atom == 0))
+            {
+                assert_(repeated.empty() || (bound->second.items.size() == n), "mismatched ... lengths");
+                n = bound->second.items.size();
+                repeated.push_back(*name);
+            }
+        }
+        assert_( ! repeated.empty(), "no pattern variable before ...");
+
+        for(std::size_t k = 0; k < n; ++k)
+        {
+            Bindings step(bindings);
+            for(std::vector<std::string>::const_iterator name = repeated.begin(); name != repeated.end(); ++name)
+            {
+                step[*name] = bindings.find(*name)->second.items[k];
+            }
+            atoms.push_back(instantiate(i->car(), step, renames));
+        }
+        i = next;
+    }
+
+    const Node* result = Node::getNull();
+    for(std::vector<const Atom*>::reverse_iterator i = atoms.rbegin(); i != atoms.rend(); ++i)
+    {
+        result = new Node(*i, result);
+    }
+    return result;
+}
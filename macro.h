@@ -0,0 +1,69 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "atoms.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// (define-macro name transformer): the transformer is called with the
+// unevaluated operands and returns the expansion.
+class Transformer : public Macro
+{
+public:
+    Transformer(const Function* function);
+    const Atom* expand(const Node* form, Env& env) const;
+    const Function* function() const;
+
+private:
+    const Function* function_;
+};
+
+// (define-syntax name (syntax-rules (literal ...) (pattern template) ...))
+//
+// Patterns may follow an element with ... to match it any number of
+// times. Symbols that a template binds with lambda and that are not
+// pattern variables are renamed in every expansion, so they cannot
+// capture the caller's variables.
+class SyntaxRules : public Macro
+{
+public:
+    SyntaxRules(const Node* spec);
+    const Atom* expand(const Node* form, Env& env) const;
+    const Node* spec() const;
+
+private:
+    struct Match
+    {
+        Match() : atom(0) {}
+
+        const Atom*        atom;
+        std::vector<Match> items;   // one per repetition under ...
+    };
+
+    struct Rule
+    {
+        const Node*           pattern;  // without the keyword
+        const Atom*           tmpl;
+        std::set<std::string> binders;  // renamed in every expansion
+    };
+
+    typedef std::map<std::string, Match>       Bindings;
+    typedef std::map<std::string, std::string> Renames;
+    typedef std::vector<Rule>                  Rules;
+
+    bool isEllipsis(const Atom* atom) const;
+    void variables(const Atom* pattern, std::set<std::string>& names) const;
+    void binders(const Atom* tmpl, const std::set<std::string>& patternVariables, std::set<std::string>& names) const;
+    bool match(const Atom* pattern, const Atom* form, Bindings& bindings) const;
+    bool matchList(Node::Iterator pattern, Node::Iterator form, Bindings& bindings) const;
+    const Atom* instantiate(const Atom* tmpl, const Bindings& bindings, const Renames& renames) const;
+
+    const Node*           spec_;
+    std::set<std::string> literals_;
+    Rules                 rules_;
+};
+
+#endif//MACRO_H
@@ -1,30 +1,215 @@
 #include "atoms.h"
 #include "parser.h"
 #include "functions.h"
+#include "jit.h"
+#include "compiler.h"
+#include "image.h"
+#include "server.h"
+#include "histogram.h"
+#include "printer.h"
 
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <list>
 #include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <unistd.h>
+
+bool readFile(const std::string& path, std::string& text)
+{
+    std::ifstream file(path.c_str());
+    if( ! file)
+    {
+        std::cerr << "cannot open " << path << std::endl;
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    text = ss.str();
+    return true;
+}
 
 void repl(const std::string& prompt, Env& env)
 {
-    std::cout << prompt << std::flush;
+    OutputBuffer output(std::cout);
+    Printer      printer(output);
+    const bool   interactive = isatty(0);
+    output.text() += prompt;
+    output.flush();
     std::string s;
     while(std::getline(std::cin, s).good())
     {
-        const Atom* atom = parse(s);
-        std::cout << *atom << " -> " << *atom->eval(env) << std::endl;
-        std::cout << prompt << std::flush;
+        const Atom* atom  = 0;
+        const Atom* value = 0;
+        if( ! LatencyStats::enabled())
+        {
+            atom  = parse(s);
+            value = atom->eval(env);
+        }
+        else
+        {
+            unsigned long long start     = nanoseconds();
+            std::size_t        allocated = Atom::allocated();
+            atom = parse(s);
+            unsigned long long parsed    = nanoseconds();
+            std::size_t        parsedAt  = Atom::allocated();
+            value = atom->eval(env);
+            LatencyStats::record(s, parsed - start, nanoseconds() - parsed, parsedAt - allocated, Atom::allocated() - parsedAt);
+        }
+        printer.print(atom);
+        output.text() += " -> ";
+        printer.print(value);
+        output.text() += '\n';
+        output.text() += prompt;
+        // answers go out before any read that may wait for more input;
+        // input that is already there is answered in blocks
+        if(interactive || (std::cin.rdbuf()->in_avail() <= 0))
+        {
+            output.flush();
+        }
+    }
+    output.text() += '\n';
+    output.flush();
+
+    if(LatencyStats::enabled())
+    {
+        LatencyStats::report(std::cerr);
     }
-    std::cout << std::endl;
 }
 
-int main(int, char* [])
+int main(int argc, char* argv[])
 {
+    std::list<std::string> preludes;
+    std::string            loadImagePath;
+    std::string            saveImagePath;
+    std::string            socketPath;
+    int                    jobs = 1;
+
+    // std::cin and std::cout buffer on their own instead of through stdio
+    std::ios::sync_with_stdio(false);
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const std::string arg(argv[i]);
+        if(arg == "--jit")
+        {
+            NativeCode::enable(100);
+        }
+        else if(arg.compare(0, 6, "--jit=") == 0)
+        {
+            NativeCode::enable(std::atoi(arg.c_str() + 6));
+        }
+        else if(arg == "--latency-stats")
+        {
+            LatencyStats::enable();
+        }
+        else if((arg == "--slow-form-ms") && (i + 1 < argc))
+        {
+            LatencyStats::logSlowForms(std::atof(argv[++i]));
+        }
+        else if((arg == "--jobs") && (i + 1 < argc))
+        {
+            jobs = std::atoi(argv[++i]);
+        }
+        else if((arg == "--emit-cpp") && (i + 1 < argc))
+        {
+            std::string program;
+            if( ! readFile(argv[++i], program))
+            {
+                return 1;
+            }
+            emitCpp(parseAll(program, jobs), argv[i], std::cout);
+            Atom::releaseAll();
+            return 0;
+        }
+        else if((arg == "--load") && (i + 1 < argc))
+        {
+            preludes.push_back(argv[++i]);
+        }
+        else if((arg == "--load-image") && (i + 1 < argc))
+        {
+            loadImagePath = argv[++i];
+        }
+        else if((arg == "--save-image") && (i + 1 < argc))
+        {
+            saveImagePath = argv[++i];
+        }
+        else if((arg == "--serve") && (i + 1 < argc))
+        {
+            socketPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
     Env env;
 
-    appendFunctions(env);
+    if(loadImagePath.empty())
+    {
+        appendFunctions(env);
+    }
+    else
+    {
+        try
+        {
+            loadImage(loadImagePath, env);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "cannot load image " << loadImagePath << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    for(std::list<std::string>::const_iterator i = preludes.begin(); i != preludes.end(); ++i)
+    {
+        std::string program;
+        if( ! readFile(*i, program))
+        {
+            return 1;
+        }
+        std::list<const Atom*> atoms = parseAll(program, jobs);
+        for(std::list<const Atom*>::const_iterator atom = atoms.begin(); atom != atoms.end(); ++atom)
+        {
+            (*atom)->eval(env);
+        }
+    }
 
-    repl("lis.cpp> ", env);
+    if( ! socketPath.empty())
+    {
+        try
+        {
+            serve(socketPath, env);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "cannot serve " << socketPath << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        repl("lis.cpp> ", env);
+    }
+
+    if( ! saveImagePath.empty())
+    {
+        try
+        {
+            saveImage(saveImagePath, env);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "cannot save image " << saveImagePath << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
     Atom::releaseAll();
 
@@ -1,10 +1,21 @@
 #include "parser.h"
+#include "bignum.h"
 
+#include <algorithm>
 #include <sstream>
 #include <list>
+#include <map>
+#include <vector>
 #include <stdexcept>
+#include <cerrno>
 #include <cstdlib>
 
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace
 {
 
@@ -14,10 +25,11 @@ const Atom* atom(const std::string& token)
 {
     char* endptr;
 
-    int i = std::strtol(token.c_str(), &endptr, 10);
+    errno = 0;
+    long long i = std::strtoll(token.c_str(), &endptr, 10);
     if(*endptr == 0)
     {
-        return new Integer(i);
+        return (errno == ERANGE) ? Bignum::create(BigInteger(token)) : new Integer(i);
     }
 
     double r = std::strtod(token.c_str(), &endptr);
@@ -29,7 +41,138 @@ const Atom* atom(const std::string& token)
     return new Symbol(token);
 }
 
-const Atom* readFrom(Tokens::const_iterator& cur, Tokens::const_iterator end)
+// Remembers the tree parsed from each source text, keyed by a hash of the
+// text, so that a form sent again is not tokenized or allocated anew.
+class ParseCache
+{
+public:
+    ParseCache() : size_(0)
+    {
+    }
+
+    const Atom* find(const std::string& text, std::size_t hash) const
+    {
+        Buckets::const_iterator bucket = buckets_.find(hash);
+        if(bucket != buckets_.end())
+        {
+            for(Entries::const_iterator i = bucket->second.begin(); i != bucket->second.end(); ++i)
+            {
+                if(i->first == text)
+                {
+                    return i->second;
+                }
+            }
+        }
+        return 0;
+    }
+
+    void insert(const std::string& text, std::size_t hash, const Atom* atom)
+    {
+        if(size_ == MaxEntries)
+        {
+            buckets_.clear();
+            size_ = 0;
+        }
+        buckets_[hash].push_back(std::make_pair(text, atom));
+        ++size_;
+    }
+
+    static std::size_t hash(const std::string& text)
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for(std::string::const_iterator i = text.begin(); i != text.end(); ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(*i)) * 1099511628211ULL;
+        }
+        return static_cast<std::size_t>(h);
+    }
+
+private:
+    typedef std::vector<std::pair<std::string, const Atom*> > Entries;
+    typedef std::map<std::size_t, Entries>                    Buckets;
+
+    static const std::size_t MaxEntries = 4096;
+
+    Buckets     buckets_;
+    std::size_t size_;
+};
+
+ParseCache parseCache;
+
+// Hash-conses small quoted data: leaves are shared by token and pairs by
+// the identity of their (already shared) car and cdr, so equal constants
+// are one allocation. Each table has a fixed number of slots and a new
+// constant simply takes over its slot, so lookups stay O(1) and memory
+// bounded; constants that lose their slot stay valid and are merely no
+// longer shared. Lists longer than MaxLength are not shared at all.
+class Constants
+{
+public:
+    static const std::size_t MaxLength = 32;
+
+    const Atom* atom(const std::string& token)
+    {
+        if(atoms_.empty())
+        {
+            atoms_.resize(AtomSlots);
+        }
+        AtomSlot& slot = atoms_[ParseCache::hash(token) & (AtomSlots - 1)];
+        if((slot.atom == 0) || (slot.token != token))
+        {
+            slot.token = token;
+            slot.atom  = ::atom(token);
+        }
+        return slot.atom;
+    }
+
+    const Node* cons(const Atom* car, const Node* cdr)
+    {
+        if(nodes_.empty())
+        {
+            nodes_.resize(1 << NodeBits);
+        }
+        unsigned long long h = reinterpret_cast<std::size_t>(car) * 31ULL + reinterpret_cast<std::size_t>(cdr);
+        NodeSlot& slot = nodes_[static_cast<std::size_t>((h * 0x9e3779b97f4a7c15ULL) >> (64 - NodeBits))];
+        if((slot.node == 0) || (slot.node->car() != car) || (slot.node->cdr() != cdr))
+        {
+            slot.node = new Node(car, cdr);
+        }
+        return slot.node;
+    }
+
+private:
+    static const std::size_t AtomSlots = 1 << 12;
+    static const int         NodeBits  = 16;
+
+    struct AtomSlot
+    {
+        AtomSlot() : atom(0) {}
+
+        std::string token;
+        const Atom* atom;
+    };
+
+    struct NodeSlot
+    {
+        NodeSlot() : node(0) {}
+
+        const Node* node;
+    };
+
+    std::vector<AtomSlot> atoms_;
+    std::vector<NodeSlot> nodes_;
+};
+
+Constants sharedConstants;
+
+
+bool isQuote(const Atom* atom)
+{
+    const Symbol* symbol = dynamic_cast<const Symbol*>(atom);
+    return (symbol != 0) && (symbol->value() == "quote");
+}
+
+const Atom* readFrom(Tokens::const_iterator& cur, Tokens::const_iterator end, Constants& constants, bool quoted)
 {
     if(cur == end)
     {
@@ -43,18 +186,25 @@ const Atom* readFrom(Tokens::const_iterator& cur, Tokens::const_iterator end)
         std::list<const Atom*> atoms;
         for(;;)
         {
+            if(cur == end)
+            {
+                throw std::runtime_error("unexpected EOF while reading");
+            }
             if(*cur == ")")
             {
                 ++cur;
                 break;
             }
-            atoms.push_back(readFrom(cur, end));
+            // the datum of (quote datum) is a constant
+            bool constant = (quoted && (atoms.size() < Constants::MaxLength)) || ((atoms.size() == 1) && isQuote(atoms.front()));
+            atoms.push_back(readFrom(cur, end, constants, constant));
         }
 
-        const Node* node = Node::getNull();
+        bool        shared = quoted && (atoms.size() <= Constants::MaxLength);
+        const Node* node   = Node::getNull();
         for(std::list<const Atom*>::reverse_iterator i = atoms.rbegin(); i != atoms.rend(); ++i)
         {
-            node = new Node(*i, node);
+            node = shared ? constants.cons(*i, node) : new Node(*i, node);
         }
         return node;
     }
@@ -64,7 +214,7 @@ const Atom* readFrom(Tokens::const_iterator& cur, Tokens::const_iterator end)
         throw std::runtime_error("unexpected");
     }
 
-    return atom(token);
+    return quoted ? constants.atom(token) : atom(token);
 }
 
 Tokens tokenize(const std::string& program)
@@ -98,11 +248,154 @@ Tokens tokenize(const std::string& program)
     return tokens;
 }
 
+const std::size_t MinChunk = 64 << 10;
+
+// Returns offsets that cut the program between top-level forms into
+// chunks of at least size bytes, starting with 0 and ending with the
+// program size. Only parentheses decide where forms end, so blocks of 16
+// bytes without any are skipped with SSE2.
+std::vector<std::size_t> split(const std::string& program, std::size_t size)
+{
+    std::vector<std::size_t> cuts(1, 0);
+    const char* p = program.data();
+    std::size_t n = program.size();
+    int depth = 0;
+
+#if defined(__SSE2__)
+    const __m128i open  = _mm_set1_epi8('(');
+    const __m128i close = _mm_set1_epi8(')');
+#endif
+
+    for(std::size_t i = 0; i < n;)
+    {
+#if defined(__SSE2__)
+        if(i + 16 <= n)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, open), _mm_cmpeq_epi8(block, close)));
+            if(mask == 0)
+            {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(mask);
+        }
+#endif
+        char c = p[i++];
+        if(c == '(')
+        {
+            ++depth;
+        }
+        else if((c == ')') && (--depth == 0) && (i - cuts.back() >= size) && (n - i >= size))
+        {
+            cuts.push_back(i);
+        }
+    }
+    cuts.push_back(n);
+    return cuts;
+}
+
+// One slice of the program, parsed on its own thread into its own heap.
+struct Chunk
+{
+    Chunk(const std::string& program, std::size_t begin, std::size_t end) : text(program, begin, end - begin)
+    {
+    }
+
+    std::string            text;
+    ThreadHeap             heap;
+    std::list<const Atom*> atoms;
+    std::string            error;
+};
+
+void* parseChunk(void* arg)
+{
+    Chunk* chunk = static_cast<Chunk*>(arg);
+    chunk->heap.attach();
+    try
+    {
+        Constants constants;
+        Tokens tokens = tokenize(chunk->text);
+        for(Tokens::const_iterator i = tokens.begin(); i != tokens.end();)
+        {
+            chunk->atoms.push_back(readFrom(i, tokens.end(), constants, false));
+        }
+    }
+    catch(const std::exception& e)
+    {
+        chunk->error = e.what();
+    }
+    chunk->heap.detach();
+    return 0;
+}
+
 } // end of anonymous namespace
 
 const Atom* parse(const std::string& program)
 {
+    std::size_t hash = ParseCache::hash(program);
+    if(const Atom* atom = parseCache.find(program, hash))
+    {
+        return atom;
+    }
+
     Tokens tokens = tokenize(program);
     Tokens::const_iterator begin = tokens.begin();
-    return readFrom(begin, tokens.end());
+    const Atom* atom = readFrom(begin, tokens.end(), sharedConstants, false);
+    parseCache.insert(program, hash, atom);
+    return atom;
+}
+
+std::list<const Atom*> parseAll(const std::string& program, int jobs)
+{
+    if((jobs <= 1) || (program.size() < 2 * MinChunk))
+    {
+        Tokens tokens = tokenize(program);
+        std::list<const Atom*> atoms;
+        for(Tokens::const_iterator i = tokens.begin(); i != tokens.end();)
+        {
+            atoms.push_back(readFrom(i, tokens.end(), sharedConstants, false));
+        }
+        return atoms;
+    }
+
+    Node::getNull();
+
+    std::vector<std::size_t> cuts = split(program, std::max(MinChunk, program.size() / jobs));
+    std::vector<Chunk*>      chunks;
+    std::vector<pthread_t>   threads;
+    for(std::size_t i = 0; i + 1 < cuts.size(); ++i)
+    {
+        chunks.push_back(new Chunk(program, cuts[i], cuts[i + 1]));
+        pthread_t thread;
+        if(pthread_create(&thread, 0, parseChunk, chunks.back()) == 0)
+        {
+            threads.push_back(thread);
+        }
+        else
+        {
+            parseChunk(chunks.back());
+        }
+    }
+    for(std::vector<pthread_t>::iterator i = threads.begin(); i != threads.end(); ++i)
+    {
+        pthread_join(*i, 0);
+    }
+
+    std::list<const Atom*> atoms;
+    std::string            error;
+    for(std::vector<Chunk*>::iterator i = chunks.begin(); i != chunks.end(); ++i)
+    {
+        if(error.empty())
+        {
+            error = (*i)->error;
+        }
+        atoms.splice(atoms.end(), (*i)->atoms);
+        delete *i;
+    }
+    if( ! error.empty())
+    {
+        throw std::runtime_error(error);
+    }
+    return atoms;
 }
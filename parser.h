@@ -3,8 +3,10 @@
 
 #include "atoms.h"
 
+#include <list>
 #include <string>
 
 const Atom* parse(const std::string& program);
+std::list<const Atom*> parseAll(const std::string& program, int jobs = 1);
 
 #endif//PARSER_H
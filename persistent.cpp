@@ -0,0 +1,493 @@
+#include "persistent.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+
+namespace
+{
+
+const int         Bits     = 5;
+const std::size_t Width    = 1 << Bits;
+const std::size_t Mask     = Width - 1;
+const int         HashBits = sizeof(std::size_t) * 8;
+
+unsigned int bitOf(std::size_t hash, int shift)
+{
+    return 1u << ((hash >> shift) & Mask);
+}
+
+std::size_t indexOf(unsigned int bitmap, unsigned int bit)
+{
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+} // end of anonymous namespace
+
+struct Vector::Trie
+{
+    Trie() : refs(1)
+    {
+        std::fill(items, items + Width, static_cast<const void*>(0));
+    }
+
+    static const Trie* retain(const Trie* t)
+    {
+        if(t != 0)
+        {
+            ++t->refs;
+        }
+        return t;
+    }
+
+    static void release(const Trie* t, int shift)
+    {
+        if((t == 0) || (--t->refs > 0))
+        {
+            return;
+        }
+        if(shift > 0)
+        {
+            for(std::size_t i = 0; i < Width; ++i)
+            {
+                release(static_cast<const Trie*>(t->items[i]), shift - Bits);
+            }
+        }
+        delete t;
+    }
+
+    static Trie* clone(const Trie* t, int shift)
+    {
+        Trie* copy = new Trie;
+        std::copy(t->items, t->items + Width, copy->items);
+        if(shift > 0)
+        {
+            for(std::size_t i = 0; i < Width; ++i)
+            {
+                retain(static_cast<const Trie*>(copy->items[i]));
+            }
+        }
+        return copy;
+    }
+
+    static const Trie* path(int shift, const Atom* value)
+    {
+        Trie* t = new Trie;
+        t->items[0] = (shift == 0) ? static_cast<const void*>(value) : path(shift - Bits, value);
+        return t;
+    }
+
+    // copies the path down to index i, creating missing branches
+    static const Trie* assoc(const Trie* t, int shift, std::size_t i, const Atom* value)
+    {
+        Trie* copy = clone(t, shift);
+        std::size_t slot = (i >> shift) & Mask;
+        if(shift == 0)
+        {
+            copy->items[slot] = value;
+        }
+        else
+        {
+            const Trie* child = static_cast<const Trie*>(t->items[slot]);
+            copy->items[slot] = (child != 0) ? assoc(child, shift - Bits, i, value) : path(shift - Bits, value);
+            release(child, shift - Bits);
+        }
+        return copy;
+    }
+
+    mutable int refs;
+    const void* items[Width];
+};
+
+const Vector* Vector::create(const std::vector<const Atom*>& atoms)
+{
+    if(atoms.empty())
+    {
+        return new Vector(0, 0, 0);
+    }
+
+    std::vector<const Trie*> level;
+    for(std::size_t i = 0; i < atoms.size(); i += Width)
+    {
+        Trie* leaf = new Trie;
+        std::copy(atoms.begin() + i, atoms.begin() + std::min(i + Width, atoms.size()), leaf->items);
+        level.push_back(leaf);
+    }
+
+    int shift = 0;
+    while(level.size() > 1)
+    {
+        std::vector<const Trie*> parents;
+        for(std::size_t i = 0; i < level.size(); i += Width)
+        {
+            Trie* parent = new Trie;
+            std::copy(level.begin() + i, level.begin() + std::min(i + Width, level.size()), parent->items);
+            parents.push_back(parent);
+        }
+        level.swap(parents);
+        shift += Bits;
+    }
+    return new Vector(level.front(), atoms.size(), shift);
+}
+
+Vector::Vector(const Trie* root, std::size_t size, int shift) : root_(root), size_(size), shift_(shift)
+{
+    pool_.push_back(this);
+}
+
+Vector::~Vector()
+{
+    Trie::release(root_, shift_);
+}
+
+void Vector::write(std::ostream& out) const
+{
+    out << "#( ";
+    for(std::size_t i = 0; i < size_; ++i)
+    {
+        out << *ref(i) << " ";
+    }
+    out << ")";
+}
+
+const Vector* Vector::eval(Env& env) const
+{
+    return this;
+}
+
+std::size_t Vector::size() const
+{
+    return size_;
+}
+
+const Atom* Vector::ref(std::size_t i) const
+{
+    assert_(i < size_, "index out of range");
+    const Trie* t = root_;
+    for(int shift = shift_; shift > 0; shift -= Bits)
+    {
+        t = static_cast<const Trie*>(t->items[(i >> shift) & Mask]);
+    }
+    return static_cast<const Atom*>(t->items[i & Mask]);
+}
+
+const Vector* Vector::set(std::size_t i, const Atom* value) const
+{
+    assert_(i < size_, "index out of range");
+    return new Vector(Trie::assoc(root_, shift_, i, value), size_, shift_);
+}
+
+const Vector* Vector::push(const Atom* value) const
+{
+    if(root_ == 0)
+    {
+        return new Vector(Trie::path(0, value), 1, 0);
+    }
+    if(size_ == (static_cast<std::size_t>(1) << (shift_ + Bits)))
+    {
+        Trie* root = new Trie;
+        root->items[0] = Trie::retain(root_);
+        root->items[1] = Trie::path(shift_, value);
+        return new Vector(root, size_ + 1, shift_ + Bits);
+    }
+    return new Vector(Trie::assoc(root_, shift_, size_, value), size_ + 1, shift_);
+}
+
+// Bitmap nodes keep inline entries and subnodes in two separately
+// ordered arrays (CHAMP layout). Once the hash is used up, a node holds
+// colliding entries in a plain list.
+struct Map::Trie
+{
+    struct Entry
+    {
+        std::size_t hash;
+        const Atom* key;
+        const Atom* value;
+    };
+
+    typedef std::vector<Entry>       Entries;
+    typedef std::vector<const Trie*> Children;
+
+    Trie() : refs(1), datamap(0), nodemap(0)
+    {
+    }
+
+    static void release(const Trie* t)
+    {
+        if(--t->refs > 0)
+        {
+            return;
+        }
+        std::for_each(t->children.begin(), t->children.end(), release);
+        delete t;
+    }
+
+    static Trie* clone(const Trie* t)
+    {
+        Trie* copy = new Trie(*t);
+        copy->refs = 1;
+        for(Children::const_iterator i = copy->children.begin(); i != copy->children.end(); ++i)
+        {
+            ++(*i)->refs;
+        }
+        return copy;
+    }
+
+    static const Trie* merge(const Entry& e1, const Entry& e2, int shift)
+    {
+        Trie* t = new Trie;
+        if(shift >= HashBits)
+        {
+            t->entries.push_back(e1);
+            t->entries.push_back(e2);
+            return t;
+        }
+
+        unsigned int b1 = bitOf(e1.hash, shift);
+        unsigned int b2 = bitOf(e2.hash, shift);
+        if(b1 == b2)
+        {
+            t->nodemap = b1;
+            t->children.push_back(merge(e1, e2, shift + Bits));
+        }
+        else
+        {
+            t->datamap = b1 | b2;
+            t->entries.push_back((b1 < b2) ? e1 : e2);
+            t->entries.push_back((b1 < b2) ? e2 : e1);
+        }
+        return t;
+    }
+
+    static const Atom* find(const Trie* t, const Atom* key, std::size_t hash)
+    {
+        for(int shift = 0; ; shift += Bits)
+        {
+            if(shift >= HashBits)
+            {
+                for(Entries::const_iterator i = t->entries.begin(); i != t->entries.end(); ++i)
+                {
+                    if(equalAtoms(i->key, key))
+                    {
+                        return i->value;
+                    }
+                }
+                return 0;
+            }
+
+            unsigned int bit = bitOf(hash, shift);
+            if((t->datamap & bit) != 0)
+            {
+                const Entry& e = t->entries[indexOf(t->datamap, bit)];
+                return ((e.hash == hash) && equalAtoms(e.key, key)) ? e.value : 0;
+            }
+            if((t->nodemap & bit) == 0)
+            {
+                return 0;
+            }
+            t = t->children[indexOf(t->nodemap, bit)];
+        }
+    }
+
+    static const Trie* assoc(const Trie* t, const Entry& entry, int shift, bool& added)
+    {
+        Trie* copy = clone(t);
+        if(shift >= HashBits)
+        {
+            for(Entries::iterator i = copy->entries.begin(); i != copy->entries.end(); ++i)
+            {
+                if(equalAtoms(i->key, entry.key))
+                {
+                    i->value = entry.value;
+                    return copy;
+                }
+            }
+            copy->entries.push_back(entry);
+            added = true;
+            return copy;
+        }
+
+        unsigned int bit = bitOf(entry.hash, shift);
+        if((copy->datamap & bit) != 0)
+        {
+            std::size_t i = indexOf(copy->datamap, bit);
+            Entry& e = copy->entries[i];
+            if((e.hash == entry.hash) && equalAtoms(e.key, entry.key))
+            {
+                e.value = entry.value;
+                return copy;
+            }
+            const Trie* sub = merge(e, entry, shift + Bits);
+            copy->entries.erase(copy->entries.begin() + i);
+            copy->datamap ^= bit;
+            copy->children.insert(copy->children.begin() + indexOf(copy->nodemap, bit), sub);
+            copy->nodemap |= bit;
+            added = true;
+        }
+        else if((copy->nodemap & bit) != 0)
+        {
+            const Trie*& child = copy->children[indexOf(copy->nodemap, bit)];
+            const Trie*  old   = child;
+            child = assoc(old, entry, shift + Bits, added);
+            release(old);
+        }
+        else
+        {
+            copy->entries.insert(copy->entries.begin() + indexOf(copy->datamap, bit), entry);
+            copy->datamap |= bit;
+            added = true;
+        }
+        return copy;
+    }
+
+    // returns 0 when the key is missing
+    static const Trie* dissoc(const Trie* t, const Atom* key, std::size_t hash, int shift)
+    {
+        if(shift >= HashBits)
+        {
+            for(std::size_t i = 0; i < t->entries.size(); ++i)
+            {
+                if(equalAtoms(t->entries[i].key, key))
+                {
+                    Trie* copy = clone(t);
+                    copy->entries.erase(copy->entries.begin() + i);
+                    return copy;
+                }
+            }
+            return 0;
+        }
+
+        unsigned int bit = bitOf(hash, shift);
+        if((t->datamap & bit) != 0)
+        {
+            std::size_t i = indexOf(t->datamap, bit);
+            const Entry& e = t->entries[i];
+            if((e.hash != hash) || ! equalAtoms(e.key, key))
+            {
+                return 0;
+            }
+            Trie* copy = clone(t);
+            copy->entries.erase(copy->entries.begin() + i);
+            copy->datamap ^= bit;
+            return copy;
+        }
+        if((t->nodemap & bit) == 0)
+        {
+            return 0;
+        }
+
+        std::size_t i   = indexOf(t->nodemap, bit);
+        const Trie* sub = dissoc(t->children[i], key, hash, shift + Bits);
+        if(sub == 0)
+        {
+            return 0;
+        }
+
+        Trie* copy = clone(t);
+        release(copy->children[i]);
+        if(sub->children.empty() && (sub->entries.size() <= 1))
+        {
+            // a subnode left with a single entry is pulled up into this node
+            copy->children.erase(copy->children.begin() + i);
+            copy->nodemap ^= bit;
+            if( ! sub->entries.empty())
+            {
+                copy->entries.insert(copy->entries.begin() + indexOf(copy->datamap, bit), sub->entries.front());
+                copy->datamap |= bit;
+            }
+            release(sub);
+        }
+        else
+        {
+            copy->children[i] = sub;
+        }
+        return copy;
+    }
+
+    static void write(const Trie* t, std::ostream& out)
+    {
+        for(Entries::const_iterator i = t->entries.begin(); i != t->entries.end(); ++i)
+        {
+            out << *i->key << " " << *i->value << " ";
+        }
+        for(Children::const_iterator i = t->children.begin(); i != t->children.end(); ++i)
+        {
+            write(*i, out);
+        }
+    }
+
+    static void pairs(const Trie* t, Pairs& out)
+    {
+        for(Entries::const_iterator i = t->entries.begin(); i != t->entries.end(); ++i)
+        {
+            out.push_back(std::make_pair(i->key, i->value));
+        }
+        for(Children::const_iterator i = t->children.begin(); i != t->children.end(); ++i)
+        {
+            pairs(*i, out);
+        }
+    }
+
+    mutable int  refs;
+    unsigned int datamap;
+    unsigned int nodemap;
+    Entries      entries;
+    Children     children;
+};
+
+Map::Map() : root_(new Trie), size_(0)
+{
+    pool_.push_back(this);
+}
+
+Map::Map(const Trie* root, std::size_t size) : root_(root), size_(size)
+{
+    pool_.push_back(this);
+}
+
+Map::~Map()
+{
+    Trie::release(root_);
+}
+
+void Map::write(std::ostream& out) const
+{
+    out << "{ ";
+    Trie::write(root_, out);
+    out << "}";
+}
+
+const Map* Map::eval(Env& env) const
+{
+    return this;
+}
+
+std::size_t Map::size() const
+{
+    return size_;
+}
+
+void Map::pairs(Pairs& out) const
+{
+    Trie::pairs(root_, out);
+}
+
+const Atom* Map::find(const Atom* key) const
+{
+    return Trie::find(root_, key, hashAtom(key));
+}
+
+const Map* Map::set(const Atom* key, const Atom* value) const
+{
+    Trie::Entry entry = { hashAtom(key), key, value };
+    bool added = false;
+    const Trie* root = Trie::assoc(root_, entry, 0, added);
+    return new Map(root, added ? size_ + 1 : size_);
+}
+
+const Map* Map::remove(const Atom* key) const
+{
+    const Trie* root = Trie::dissoc(root_, key, hashAtom(key), 0);
+    return (root != 0) ? new Map(root, size_ - 1) : this;
+}
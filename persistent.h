@@ -0,0 +1,60 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+#include "atoms.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Immutable vector stored as a 32-way trie. Updates copy only the path
+// from the root to the changed leaf and share everything else.
+class Vector : public Atom
+{
+public:
+    static const Vector* create(const std::vector<const Atom*>& atoms);
+
+    ~Vector();
+    void write(std::ostream& out) const;
+    const Vector* eval(Env& env) const;
+    std::size_t size() const;
+    const Atom* ref(std::size_t i) const;
+    const Vector* set(std::size_t i, const Atom* value) const;
+    const Vector* push(const Atom* value) const;
+
+private:
+    struct Trie;
+
+    Vector(const Trie* root, std::size_t size, int shift);
+
+    const Trie*       root_;
+    const std::size_t size_;
+    const int         shift_;
+};
+
+// Immutable hash array mapped trie keyed by hashAtom/equalAtoms.
+class Map : public Atom
+{
+public:
+    typedef std::vector<std::pair<const Atom*, const Atom*> > Pairs;
+
+    Map();
+    ~Map();
+    void write(std::ostream& out) const;
+    const Map* eval(Env& env) const;
+    std::size_t size() const;
+    const Atom* find(const Atom* key) const;
+    const Map* set(const Atom* key, const Atom* value) const;
+    const Map* remove(const Atom* key) const;
+    void pairs(Pairs& out) const;
+
+private:
+    struct Trie;
+
+    Map(const Trie* root, std::size_t size);
+
+    const Trie*       root_;
+    const std::size_t size_;
+};
+
+#endif//PERSISTENT_H
@@ -0,0 +1,155 @@
+#include "printer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <typeinfo>
+#include <vector>
+
+Printer::Printer(std::string& out) : out_(out), output_(0)
+{
+}
+
+Printer::Printer(OutputBuffer& output) : out_(output.text()), output_(&output)
+{
+}
+
+void Printer::print(const Atom* atom)
+{
+    // the rest of every list still being printed
+    std::vector<const Node*> pending;
+    for(;;)
+    {
+        if(typeid(*atom) == typeid(Node))
+        {
+            out_ += "( ";
+            pending.push_back(static_cast<const Node*>(atom));
+        }
+        else
+        {
+            leaf(atom);
+            if(pending.empty())
+            {
+                return;
+            }
+            out_ += ' ';
+        }
+        if(output_ != 0)
+        {
+            output_->flushIfFull();
+        }
+
+        for(;;)
+        {
+            const Node*& rest = pending.back();
+            if((rest != 0) && (rest->length() > 0))
+            {
+                atom = rest->car();
+                rest = rest->cdr();
+                break;
+            }
+            out_ += ')';
+            pending.pop_back();
+            if(pending.empty())
+            {
+                return;
+            }
+            out_ += ' ';
+        }
+    }
+}
+
+void Printer::integer(long long i, std::string& out)
+{
+    char buffer[24];
+    char* p = buffer + sizeof(buffer);
+    unsigned long long u = (i < 0) ? 0ULL - static_cast<unsigned long long>(i) : i;
+    do
+    {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while(u != 0);
+    if(i < 0)
+    {
+        *--p = '-';
+    }
+    out.append(p, buffer + sizeof(buffer));
+}
+
+void Printer::real(double r, std::string& out)
+{
+    char buffer[32];
+    for(int precision = 1; precision <= 17; ++precision)
+    {
+        std::sprintf(buffer, "%.*g", precision, r);
+        if((std::strtod(buffer, 0) == r) || (r != r))
+        {
+            break;
+        }
+    }
+    out += buffer;
+    // so that the text reads back as a Real
+    if(std::strpbrk(buffer, ".ein") == 0)
+    {
+        out += ".0";
+    }
+}
+
+void Printer::leaf(const Atom* atom)
+{
+    const std::type_info& type = typeid(*atom);
+    if(type == typeid(Integer))
+    {
+        integer(static_cast<const Integer*>(atom)->value(), out_);
+    }
+    else if(type == typeid(Symbol))
+    {
+        out_ += static_cast<const Symbol*>(atom)->value();
+    }
+    else if(type == typeid(Real))
+    {
+        real(static_cast<const Real*>(atom)->value(), out_);
+    }
+    else if(type == typeid(Bool))
+    {
+        out_ += static_cast<const Bool*>(atom)->value() ? "true" : "false";
+    }
+    else
+    {
+        std::ostringstream ss;
+        atom->write(ss);
+        out_ += ss.str();
+    }
+}
+
+OutputBuffer::OutputBuffer(std::ostream& out, std::size_t limit) : out_(out), limit_(limit)
+{
+    text_.reserve(limit + limit / 4);
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    flush();
+}
+
+std::string& OutputBuffer::text()
+{
+    return text_;
+}
+
+void OutputBuffer::flushIfFull()
+{
+    if(text_.size() >= limit_)
+    {
+        flush();
+    }
+}
+
+void OutputBuffer::flush()
+{
+    out_.write(text_.data(), text_.size());
+    out_.flush();
+    text_.clear();
+}
@@ -0,0 +1,51 @@
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include "atoms.h"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+// Collects output for a stream and writes it in large blocks.
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(std::ostream& out, std::size_t limit = 64 << 10);
+    ~OutputBuffer();
+
+    std::string& text();
+    void flushIfFull();
+    void flush();
+
+private:
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator = (const OutputBuffer&);
+
+    std::ostream&     out_;
+    const std::size_t limit_;
+    std::string       text_;
+};
+
+// Appends the printed form of atoms to a string. Nested lists are walked
+// with an explicit stack, so the depth of the data does not matter. When
+// printing into an OutputBuffer, a large result is written out block by
+// block while it is printed.
+class Printer
+{
+public:
+    explicit Printer(std::string& out);
+    explicit Printer(OutputBuffer& output);
+    void print(const Atom* atom);
+
+    static void integer(long long i, std::string& out);
+    static void real(double r, std::string& out);   // shortest form that reads back as the Real r
+
+private:
+    void leaf(const Atom* atom);
+
+    std::string&  out_;
+    OutputBuffer* output_;
+};
+
+#endif//PRINTER_H
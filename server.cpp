@@ -0,0 +1,370 @@
+#include "server.h"
+#include "histogram.h"
+#include "parser.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+const std::size_t MaxFrame   = 16 << 20;
+const std::size_t MaxPending = 1 << 20;     // answers held for a client before it is no longer read from
+const std::size_t ChunkSize  = 64 << 10;
+const int         MaxEvents = 64;
+
+const char StatsRequest[] = ":stats";
+
+void check(bool cond, const std::string& what)
+{
+    if( ! cond)
+    {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+}
+
+void nonblocking(int fd)
+{
+    check(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0, "fcntl");
+}
+
+void frame(std::string& out, const std::string& payload)
+{
+    std::size_t n = payload.size();
+    out += static_cast<char>((n >> 24) & 0xff);
+    out += static_cast<char>((n >> 16) & 0xff);
+    out += static_cast<char>((n >> 8) & 0xff);
+    out += static_cast<char>(n & 0xff);
+    out += payload;
+}
+
+struct Session
+{
+    Session(int fd, const Env& global) : fd(fd), env(&global), eof(false), events(EPOLLIN)
+    {
+    }
+
+    ~Session()
+    {
+        close(fd);
+    }
+
+    int         fd;
+    Env         env;
+    std::string input;
+    std::string output;
+    bool        eof;
+    unsigned    events;
+};
+
+class Server
+{
+public:
+    Server(const std::string& path, Env& env) : env_(env), path_(path), listener_(-1), epoll_(-1), signals_(-1), masked_(false), started_(nanoseconds()), requests_(0)
+    {
+        try
+        {
+            open();
+        }
+        catch(...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    ~Server()
+    {
+        release();
+    }
+
+    // returns once SIGINT or SIGTERM is received
+    void run()
+    {
+        epoll_event events[MaxEvents];
+        for(;;)
+        {
+            int n = epoll_wait(epoll_, events, MaxEvents, -1);
+            if((n < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            check(n >= 0, "epoll_wait");
+
+            for(int i = 0; i < n; ++i)
+            {
+                if(events[i].data.fd == signals_)
+                {
+                    signalfd_siginfo info;
+                    if(read(signals_, &info, sizeof(info)) == sizeof(info))
+                    {
+                        return;
+                    }
+                    continue;
+                }
+                if(events[i].data.fd == listener_)
+                {
+                    accept();
+                    continue;
+                }
+
+                Session* session = sessions_[events[i].data.fd];
+                bool alive = receive(*session) && answer(*session) && send(*session);
+                // requests held back at MaxPending are answered once the client has taken the rest
+                for(std::size_t left = 0; alive && session->output.empty() && (session->input.size() != left); )
+                {
+                    left = session->input.size();
+                    alive = answer(*session) && send(*session);
+                }
+                if(( ! alive) || (session->eof && session->output.empty()))
+                {
+                    drop(session);
+                }
+                else
+                {
+                    // stop reading once the peer is done or is not taking its answers;
+                    // wait for room only with output pending
+                    bool     full   = session->output.size() > MaxPending;
+                    unsigned wanted = ((session->eof || full) ? 0 : EPOLLIN) | (session->output.empty() ? 0 : EPOLLOUT);
+                    if(wanted != session->events)
+                    {
+                        session->events = wanted;
+                        watch(session->fd, wanted, EPOLL_CTL_MOD);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    void open()
+    {
+        sockaddr_un address;
+        check(path_.size() < sizeof(address.sun_path), path_);
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, path_.c_str());
+        unlink(path_.c_str());
+
+        listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        check(listener_ >= 0, "socket");
+        nonblocking(listener_);
+        check(bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0, "bind " + path_);
+        check(listen(listener_, SOMAXCONN) == 0, "listen");
+
+        epoll_ = epoll_create(MaxEvents);
+        check(epoll_ >= 0, "epoll_create");
+        watch(listener_, EPOLLIN, EPOLL_CTL_ADD);
+
+        // SIGINT and SIGTERM arrive as readable data instead of killing the process
+        sigset_t stop;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        check(sigprocmask(SIG_BLOCK, &stop, &blocked_) == 0, "sigprocmask");
+        masked_ = true;
+        signals_ = signalfd(-1, &stop, SFD_NONBLOCK);
+        check(signals_ >= 0, "signalfd");
+        watch(signals_, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    // closes whatever has been opened and restores the signal mask
+    void release()
+    {
+        for(std::map<int, Session*>::iterator i = sessions_.begin(); i != sessions_.end(); ++i)
+        {
+            delete i->second;
+        }
+        sessions_.clear();
+        if(epoll_ >= 0)
+        {
+            close(epoll_);
+        }
+        if(listener_ >= 0)
+        {
+            close(listener_);
+            unlink(path_.c_str());
+        }
+        if(signals_ >= 0)
+        {
+            close(signals_);
+        }
+        if(masked_)
+        {
+            sigprocmask(SIG_SETMASK, &blocked_, 0);
+        }
+    }
+
+    void watch(int fd, unsigned events, int operation)
+    {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events  = events;
+        event.data.fd = fd;
+        check(epoll_ctl(epoll_, operation, fd, &event) == 0, "epoll_ctl");
+    }
+
+    void accept()
+    {
+        for(;;)
+        {
+            int fd = ::accept(listener_, 0, 0);
+            if(fd < 0)
+            {
+                check((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ECONNABORTED), "accept");
+                return;
+            }
+            nonblocking(fd);
+            sessions_[fd] = new Session(fd, env_);
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void drop(Session* session)
+    {
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, session->fd, 0);
+        sessions_.erase(session->fd);
+        delete session;
+    }
+
+    // reads what is available unless more than MaxPending of answers are
+    // waiting; returns false when the connection has to be closed
+    bool receive(Session& session)
+    {
+        char buffer[ChunkSize];
+        while(( ! session.eof) && (session.output.size() <= MaxPending))
+        {
+            ssize_t n = read(session.fd, buffer, sizeof(buffer));
+            if(n > 0)
+            {
+                session.input.append(buffer, n);
+            }
+            else if(n == 0)
+            {
+                session.eof = true;
+            }
+            else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            else if(errno != EINTR)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // answers complete frames in order while the answers fit under
+    // MaxPending; returns false on a frame that is too large
+    bool answer(Session& session)
+    {
+        std::size_t pos = 0;
+        while((session.output.size() <= MaxPending) && (session.input.size() - pos >= 4))
+        {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(session.input.data() + pos);
+            std::size_t n = (static_cast<std::size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            if(n > MaxFrame)
+            {
+                return false;
+            }
+            if(session.input.size() - pos - 4 < n)
+            {
+                break;
+            }
+            handle(session, session.input.substr(pos + 4, n));
+            pos += 4 + n;
+        }
+        session.input.erase(0, pos);
+        return true;
+    }
+
+    bool send(Session& session)
+    {
+        std::size_t pos = 0;
+        while(pos < session.output.size())
+        {
+            ssize_t n = ::send(session.fd, session.output.data() + pos, session.output.size() - pos, MSG_NOSIGNAL);
+            if(n >= 0)
+            {
+                pos += n;
+            }
+            else if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            else if(errno != EINTR)
+            {
+                return false;
+            }
+        }
+        session.output.erase(0, pos);
+        return true;
+    }
+
+    void handle(Session& session, const std::string& request)
+    {
+        if(request == StatsRequest)
+        {
+            frame(session.output, "ok " + stats());
+            return;
+        }
+
+        unsigned long long start = nanoseconds();
+        std::string reply;
+        try
+        {
+            std::ostringstream ss;
+            ss << *parse(request)->eval(session.env);
+            reply = "ok " + ss.str();
+        }
+        catch(const std::exception& e)
+        {
+            reply = std::string("error ") + e.what();
+        }
+        frame(session.output, reply);
+        latency_.record(nanoseconds() - start);
+        ++requests_;
+    }
+
+    std::string stats() const
+    {
+        double seconds = (nanoseconds() - started_) / 1e9;
+        char buffer[256];
+        std::sprintf(buffer, "requests %llu\nrequests/s %.1f\np50 %.1fus\np99 %.1fus\np999 %.1fus\nmax %.1fus",
+                     requests_, (seconds > 0) ? requests_ / seconds : 0.0,
+                     latency_.percentile(50) / 1e3, latency_.percentile(99) / 1e3, latency_.percentile(99.9) / 1e3, latency_.max() / 1e3);
+        return buffer;
+    }
+
+    Env&                    env_;
+    const std::string       path_;
+    int                     listener_;
+    int                     epoll_;
+    int                     signals_;
+    bool                    masked_;
+    sigset_t                blocked_;   // the mask to restore
+    std::map<int, Session*> sessions_;
+    Histogram               latency_;
+    unsigned long long      started_;
+    unsigned long long      requests_;
+};
+
+} // end of anonymous namespace
+
+void serve(const std::string& path, Env& env)
+{
+    Server(path, env).run();
+}
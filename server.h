@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "atoms.h"
+
+#include <string>
+
+// Serves requests on a Unix domain socket. Every request and response is
+// a frame: a 4-byte big-endian length followed by that many bytes. A
+// request holds one expression, or ":stats"; the response is "ok " and the
+// printed result, or "error " and the message. Each connection evaluates
+// in its own scope on top of env, and requests may be pipelined.
+// Returns after SIGINT or SIGTERM, once the socket file is removed.
+void serve(const std::string& path, Env& env);
+
+#endif//SERVER_H
@@ -0,0 +1,19 @@
+(define add (lambda (x y) (+ x y)))
+(define sub (lambda (x y) (- x y)))
+(define mul (lambda (x y) (* x y)))
+(define div (lambda (x y) (/ x y)))
+(add 1 2)
+(add -5 3)
+(sub 10 25)
+(mul -7 6)
+(div 17 5)
+(div -17 5)
+(div 17 -5)
+(define poly (lambda (x) (+ (* 3 (* x x)) (- (* 2 x) 7))))
+(poly 0)
+(poly 11)
+(poly -1000)
+(add 1.5 2)
+(mul 2 2.5)
+(div 1 4)
+(poly 0.5)
@@ -0,0 +1,16 @@
+(define sign (lambda (x) (if (< x 0) -1 (if (> x 0) 1 0))))
+(sign -42)
+(sign 0)
+(sign 42)
+(define clamp (lambda (x lo hi) (if (< x lo) lo (if (> x hi) hi x))))
+(clamp 5 0 10)
+(clamp -5 0 10)
+(clamp 50 0 10)
+(define between (lambda (x lo hi) (if (<= lo x) (if (>= hi x) 1 0) 0)))
+(between 3 3 3)
+(between 2 3 4)
+(define same (lambda (x y) (if (= x y) 1 0)))
+(same 7 7)
+(same 7 8)
+(sign 2.5)
+(same 2 2.0)
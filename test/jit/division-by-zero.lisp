@@ -0,0 +1,3 @@
+(define div (lambda (x y) (/ x y)))
+(div 10 2)
+(div 10 0)
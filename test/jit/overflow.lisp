@@ -0,0 +1,16 @@
+(define fact (lambda (n) (if (< n 2) 1 (* n (fact (- n 1))))))
+(fact 20)
+(fact 21)
+(fact 30)
+(define add (lambda (x y) (+ x y)))
+(add 9223372036854775807 1)
+(add -9223372036854775807 -2)
+(define sub (lambda (x y) (- x y)))
+(sub -9223372036854775807 2)
+(define mul (lambda (x y) (* x y)))
+(mul 4294967296 4294967296)
+(mul 3037000499 3037000499)
+(define div (lambda (x y) (/ x y)))
+(div (- -9223372036854775807 1) -1)
+(add 99999999999999999999 1)
+(fact 5)
@@ -0,0 +1,10 @@
+(define sq (lambda (x) (* x x)))
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(sq 7)
+(fib 15)
+(define * +)
+(sq 7)
+(define + -)
+(fib 10)
+(define fib (lambda (n) (if (< n 0) 0 n)))
+(fib 10)
@@ -0,0 +1,13 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 0)
+(fib 1)
+(fib 22)
+(define fact (lambda (n) (if (< n 2) 1 (* n (fact (- n 1))))))
+(fact 10)
+(fact 20)
+(define sum (lambda (n acc) (if (= n 0) acc (sum (- n 1) (+ acc n)))))
+(sum 1000 0)
+(define ack (lambda (m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1)))))))
+(ack 2 3)
+(define gcd (lambda (a b) (if (= b 0) a (gcd b (- a (* b (/ a b)))))))
+(gcd 1071 462)